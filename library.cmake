@@ -1,3 +1,8 @@
 
 include_directories(BEFORE ${CMAKE_CURRENT_LIST_DIR}/src)
 
+
+set(COCLS_ENABLE_USDT OFF CACHE BOOL "Enable USDT static tracepoints (requires sys/sdt.h)")
+if (COCLS_ENABLE_USDT)
+    add_compile_definitions(COCLS_ENABLE_USDT)
+endif()
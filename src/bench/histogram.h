@@ -0,0 +1,144 @@
+/**
+ * @file histogram.h
+ *
+ * Log-linear latency histogram (HDR style)
+ *
+ * Values are stored in buckets, where each power of two range is divided into
+ * fixed count of linear sub-buckets. This keeps relative error constant (about 0.8% for
+ * default settings) for any recorded value while the memory footprint stays small
+ * and fixed.
+ *
+ * Recording is MT safe and lock-free, counters are updated using relaxed atomic
+ * increments, so the histogram can be shared by all threads of the benchmark
+ */
+#pragma once
+#ifndef SRC_BENCH_HISTOGRAM_H_
+#define SRC_BENCH_HISTOGRAM_H_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstdio>
+
+namespace bench {
+
+///Log-linear histogram of latencies
+/**
+ * @tparam sub_bits count of bits for linear part. Each power of two range is divided
+ * into 2^sub_bits buckets
+ * @tparam max_bits highest trackable value is 2^max_bits. Larger values are clamped, but
+ * max() still reports exact value
+ */
+template<unsigned sub_bits = 7, unsigned max_bits = 40>
+class log_linear_histogram {
+public:
+
+    static constexpr std::uint64_t sub_count = std::uint64_t(1) << sub_bits;
+    static constexpr unsigned max_shift = max_bits - sub_bits - 1;
+    static constexpr std::size_t bucket_count = (max_shift + 2) * sub_count;
+    static constexpr std::uint64_t highest_trackable = (std::uint64_t(1) << max_bits) - 1;
+
+    log_linear_histogram() = default;
+    log_linear_histogram(const log_linear_histogram &) = delete;
+    log_linear_histogram &operator=(const log_linear_histogram &) = delete;
+
+    ///record single value
+    void record(std::uint64_t value) {
+        record(value, 1);
+    }
+
+    ///record value multiple times
+    void record(std::uint64_t value, std::uint64_t count) {
+        _counts[index_of(std::min(value, highest_trackable))].fetch_add(count, std::memory_order_relaxed);
+        _total.fetch_add(count, std::memory_order_relaxed);
+        std::uint64_t m = _max.load(std::memory_order_relaxed);
+        while (m < value && !_max.compare_exchange_weak(m, value, std::memory_order_relaxed));
+    }
+
+    ///clear histogram
+    void reset() {
+        for (auto &x: _counts) x.store(0, std::memory_order_relaxed);
+        _total.store(0, std::memory_order_relaxed);
+        _max.store(0, std::memory_order_relaxed);
+    }
+
+    ///count of recorded samples
+    std::uint64_t count() const {
+        return _total.load(std::memory_order_relaxed);
+    }
+
+    ///maximum recorded value (exact)
+    std::uint64_t max() const {
+        return _max.load(std::memory_order_relaxed);
+    }
+
+    ///retrieve value at given percentile
+    /**
+     * @param pct percentile 0-100
+     * @return highest value equivalent to the bucket containing the percentile. Result
+     * is never greater than max()
+     */
+    std::uint64_t percentile(double pct) const {
+        std::uint64_t total = count();
+        if (total == 0) return 0;
+        std::uint64_t target = static_cast<std::uint64_t>(pct * static_cast<double>(total) / 100.0 + 0.5);
+        target = std::clamp<std::uint64_t>(target, 1, total);
+        std::uint64_t sum = 0;
+        for (std::size_t i = 0; i < bucket_count; i++) {
+            sum += _counts[i].load(std::memory_order_relaxed);
+            if (sum >= target) return std::min(highest_equivalent(i), max());
+        }
+        return max();
+    }
+
+    ///print summary line
+    /**
+     * @param name name of the case
+     * @param unit_div divider to convert recorded values to printed unit
+     * @param unit name of printed unit
+     */
+    void print(const char *name, double unit_div = 1000.0, const char *unit = "us") const {
+        std::printf("%-24s count=%-9llu p50=%.2f%s p99=%.2f%s p99.9=%.2f%s max=%.2f%s\n",
+                name, static_cast<unsigned long long>(count()),
+                percentile(50.0)/unit_div, unit,
+                percentile(99.0)/unit_div, unit,
+                percentile(99.9)/unit_div, unit,
+                max()/unit_div, unit);
+    }
+
+    static constexpr std::size_t index_of(std::uint64_t value) {
+        unsigned m = static_cast<unsigned>(std::bit_width(value));
+        if (m <= sub_bits+1) return static_cast<std::size_t>(value);
+        unsigned shift = m - sub_bits - 1;
+        return static_cast<std::size_t>((shift + 1) * sub_count + ((value >> shift) - sub_count));
+    }
+
+    static constexpr std::uint64_t lowest_equivalent(std::size_t index) {
+        if (index < 2*sub_count) return index;
+        unsigned shift = static_cast<unsigned>(index / sub_count - 1);
+        return (index % sub_count + sub_count) << shift;
+    }
+
+    static constexpr std::uint64_t highest_equivalent(std::size_t index) {
+        if (index < 2*sub_count) return index;
+        unsigned shift = static_cast<unsigned>(index / sub_count - 1);
+        return lowest_equivalent(index) + (std::uint64_t(1) << shift) - 1;
+    }
+
+protected:
+    std::array<std::atomic<std::uint64_t>, bucket_count> _counts = {};
+    std::atomic<std::uint64_t> _total = 0;
+    std::atomic<std::uint64_t> _max = 0;
+};
+
+using latency_histogram = log_linear_histogram<>;
+
+static_assert(latency_histogram::index_of(latency_histogram::highest_trackable) < latency_histogram::bucket_count);
+static_assert(latency_histogram::lowest_equivalent(latency_histogram::index_of(1000)) <= 1000);
+static_assert(latency_histogram::highest_equivalent(latency_histogram::index_of(1000)) >= 1000);
+
+}
+
+#endif /* SRC_BENCH_HISTOGRAM_H_ */
@@ -0,0 +1,201 @@
+/**
+ * @file latency.cpp
+ *
+ * Tail latency harness
+ *
+ * Drives open-loop load at fixed rate through various parts of the library and
+ * records latency of each operation into log-linear histogram. Latency is always
+ * measured from the time, when the operation was intended to be issued, not when
+ * it was actually issued. This corrects coordinated omission, because stalls of the load
+ * generator are accounted to the measured operations
+ *
+ * usage: latency [--perf] [rate_per_sec] [seconds] [threads]
+ *
+ * --perf   also report hardware performance counters per operation (Linux only)
+ */
+#include "histogram.h"
+#include "perf_counters.h"
+
+#include <coclasses/dispatcher.h>
+#include <coclasses/queue.h>
+#include <coclasses/scheduler.h>
+#include <coclasses/task.h>
+#include <coclasses/thread_pool.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+using steady_clock = std::chrono::steady_clock;
+
+struct options {
+    unsigned rate = 10000;
+    std::chrono::nanoseconds duration = std::chrono::seconds(2);
+    unsigned threads = std::thread::hardware_concurrency();
+    std::chrono::nanoseconds timer_delay = std::chrono::milliseconds(1);
+    bool perf = false;
+};
+
+static std::uint64_t to_ns(steady_clock::duration d) {
+    return static_cast<std::uint64_t>(std::max<std::int64_t>(0,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()));
+}
+
+static void wait_until(steady_clock::time_point tp) {
+    auto now = steady_clock::now();
+    if (tp - now > std::chrono::microseconds(200)) {
+        std::this_thread::sleep_until(tp - std::chrono::microseconds(100));
+    }
+    while (steady_clock::now() < tp) std::this_thread::yield();
+}
+
+///Generates operations at fixed rate
+/**
+ * @param opt options
+ * @param fn function called for every operation with intended time
+ * @return count of issued operations
+ */
+template<typename Fn>
+static std::uint64_t drive_open_loop(const options &opt, Fn &&fn) {
+    auto period = std::chrono::nanoseconds(std::chrono::seconds(1)) / opt.rate;
+    auto start = steady_clock::now();
+    std::uint64_t i = 0;
+    for (;;++i) {
+        auto intended = start + period * i;
+        if (intended - start >= opt.duration) break;
+        wait_until(intended);
+        fn(intended);
+    }
+    return i;
+}
+
+static void wait_for_count(const std::atomic<std::uint64_t> &counter, std::uint64_t count) {
+    while (counter.load(std::memory_order_acquire) < count) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+///thread_pool: time from intended submission to start of execution in a worker
+static std::uint64_t case_thread_pool(const options &opt, bench::latency_histogram &hist) {
+    std::atomic<std::uint64_t> done = 0;
+    cocls::thread_pool pool(opt.threads);
+    auto issued = drive_open_loop(opt, [&](steady_clock::time_point intended){
+        pool.run_detached([&hist, &done, intended]{
+            hist.record(to_ns(steady_clock::now() - intended));
+            done.fetch_add(1, std::memory_order_release);
+        });
+    });
+    wait_for_count(done, issued);
+    return issued;
+}
+
+static cocls::task<void, cocls::resumption_policy::dispatcher>
+dispatcher_consumer(cocls::queue<steady_clock::time_point> &q, bench::latency_histogram &hist) {
+    for(;;) {
+        auto intended = co_await q.pop();
+        if (intended == steady_clock::time_point::max()) break;
+        hist.record(to_ns(steady_clock::now() - intended));
+    }
+}
+
+///dispatcher: time from intended wakeup to resumption in dispatcher's thread
+static std::uint64_t case_dispatcher(const options &opt, bench::latency_histogram &hist) {
+    cocls::queue<steady_clock::time_point> q;
+    std::thread thr([&]{
+        cocls::dispatcher::init();
+        auto t = dispatcher_consumer(q, hist);
+        cocls::dispatcher::await(t);
+    });
+    auto issued = drive_open_loop(opt, [&](steady_clock::time_point intended){
+        q.push(intended);
+    });
+    q.push(steady_clock::time_point::max());
+    thr.join();
+    return issued;
+}
+
+///scheduler: lateness of the timer relative to its deadline
+static std::uint64_t case_scheduler(const options &opt, bench::latency_histogram &hist) {
+    std::atomic<std::uint64_t> done = 0;
+    cocls::thread_pool pool(opt.threads);
+    cocls::scheduler sch(pool);
+    auto sys_start = std::chrono::system_clock::now();
+    auto steady_start = steady_clock::now();
+    auto issued = drive_open_loop(opt, [&](steady_clock::time_point intended){
+        auto deadline = sys_start + std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                intended - steady_start + opt.timer_delay);
+        sch.schedule(nullptr, cocls::make_promise<void>([&hist, &done, deadline](cocls::future<void> &){
+            auto late = std::chrono::system_clock::now() - deadline;
+            hist.record(to_ns(std::chrono::duration_cast<steady_clock::duration>(late)));
+            done.fetch_add(1, std::memory_order_release);
+        }), deadline);
+    });
+    wait_for_count(done, issued);
+    return issued;
+}
+
+///queue: time from intended push to wakeup of a thread blocked on pop()
+static std::uint64_t case_queue(const options &opt, bench::latency_histogram &hist) {
+    cocls::queue<steady_clock::time_point> q;
+    std::thread thr([&]{
+        for(;;) {
+            auto intended = q.pop().wait();
+            if (intended == steady_clock::time_point::max()) break;
+            hist.record(to_ns(steady_clock::now() - intended));
+        }
+    });
+    auto issued = drive_open_loop(opt, [&](steady_clock::time_point intended){
+        q.push(intended);
+    });
+    q.push(steady_clock::time_point::max());
+    thr.join();
+    return issued;
+}
+
+///Benchmark case. Returns count of issued operations. All threads must be joined before return
+using case_fn = std::uint64_t (*)(const options &, bench::latency_histogram &);
+
+static void run_case(const char *name, case_fn fn, const options &opt) {
+    bench::latency_histogram hist;
+    if (opt.perf) {
+        bench::perf_counters counters;
+        counters.start();
+        auto ops = fn(opt, hist);
+        auto res = counters.stop();
+        hist.print(name);
+        res.print(ops);
+    } else {
+        fn(opt, hist);
+        hist.print(name);
+    }
+}
+
+int main(int argc, char **argv) {
+    options opt;
+    const char *args[3] = {};
+    int argn = 0;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--perf") == 0) opt.perf = true;
+        else if (argn < 3) args[argn++] = argv[i];
+    }
+    if (args[0]) opt.rate = std::max(1, std::atoi(args[0]));
+    if (args[1]) opt.duration = std::chrono::seconds(std::max(1, std::atoi(args[1])));
+    if (args[2]) opt.threads = std::max(1, std::atoi(args[2]));
+
+    std::printf("open-loop rate=%u/s duration=%llds threads=%u\n", opt.rate,
+            static_cast<long long>(std::chrono::duration_cast<std::chrono::seconds>(opt.duration).count()),
+            opt.threads);
+    if (opt.perf && !bench::perf_counters().available()) {
+        std::printf("perf events are not available, counters will not be reported\n");
+    }
+
+    run_case("thread_pool", &case_thread_pool, opt);
+    run_case("dispatcher", &case_dispatcher, opt);
+    run_case("scheduler timer", &case_scheduler, opt);
+    run_case("queue handoff", &case_queue, opt);
+    return 0;
+}
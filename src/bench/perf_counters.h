@@ -0,0 +1,153 @@
+/**
+ * @file perf_counters.h
+ *
+ * Hardware performance counters for the benchmark harness
+ *
+ * Uses Linux perf_event_open(). Counters are opened for the calling thread with
+ * inherit flag, so they also count all threads created while the counters are
+ * active. Values of such threads are accumulated when they exit, so counters
+ * must be read after all threads of the measured case are joined.
+ *
+ * When perf events are not available (other platform, container, restrictive
+ * perf_event_paranoid), the counters are reported as not available, and the benchmark
+ * continues without them
+ */
+#pragma once
+#ifndef SRC_BENCH_PERF_COUNTERS_H_
+#define SRC_BENCH_PERF_COUNTERS_H_
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+namespace bench {
+
+///Set of performance counters opened around one benchmark case
+class perf_counters {
+public:
+
+    enum counter_id {
+        cycles,
+        instructions,
+        cache_misses,
+        branch_misses,
+        context_switches,
+        counter_count
+    };
+
+    ///Result of measurement
+    struct result {
+        ///value of counter
+        std::array<std::uint64_t, counter_count> values = {};
+        ///true if the counter was available
+        std::array<bool, counter_count> valid = {};
+
+        ///print values per operation
+        /**
+         * @param ops count of operations of the case
+         */
+        void print(std::uint64_t ops) const {
+            static constexpr const char *names[] = {
+                    "cycles","instructions","cache-misses","branch-misses","ctx-switches"
+            };
+            std::printf("%-24s", "  per op:");
+            for (int i = 0; i < counter_count; i++) {
+                if (valid[i] && ops) {
+                    std::printf(" %s=%.2f", names[i], static_cast<double>(values[i])/static_cast<double>(ops));
+                } else {
+                    std::printf(" %s=n/a", names[i]);
+                }
+            }
+            std::printf("\n");
+        }
+    };
+
+    ///Opens counters. Counters are not started yet
+    perf_counters() {
+        _fds.fill(-1);
+#ifdef __linux__
+        open(cycles, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        open(instructions, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        open(cache_misses, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+        open(branch_misses, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+        open(context_switches, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES);
+#endif
+    }
+
+    perf_counters(const perf_counters &) = delete;
+    perf_counters &operator=(const perf_counters &) = delete;
+
+    ~perf_counters() {
+#ifdef __linux__
+        for (int fd: _fds) if (fd >= 0) ::close(fd);
+#endif
+    }
+
+    ///true if at least one counter is available
+    bool available() const {
+        for (int fd: _fds) if (fd >= 0) return true;
+        return false;
+    }
+
+    ///reset and start counting
+    void start() {
+#ifdef __linux__
+        for (int fd: _fds) if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    ///stop counting and read values
+    /**
+     * @return values. Call this after all threads created during measurement are joined
+     */
+    result stop() {
+        result r;
+#ifdef __linux__
+        for (int i = 0; i < counter_count; i++) {
+            int fd = _fds[i];
+            if (fd < 0) continue;
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            std::uint64_t v;
+            if (::read(fd, &v, sizeof(v)) == sizeof(v)) {
+                r.values[i] = v;
+                r.valid[i] = true;
+            }
+        }
+#endif
+        return r;
+    }
+
+protected:
+    std::array<int, counter_count> _fds;
+
+#ifdef __linux__
+    void open(counter_id id, std::uint32_t type, std::uint64_t config) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = type == PERF_TYPE_HARDWARE;
+        attr.exclude_hv = 1;
+        long fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        _fds[id] = static_cast<int>(fd);
+    }
+#endif
+};
+
+}
+
+#endif /* SRC_BENCH_PERF_COUNTERS_H_ */
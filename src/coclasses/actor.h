@@ -0,0 +1,200 @@
+/**
+ * @file actor.h
+ *
+ * Actor runtime - with_queue coroutines hosted on a thread_pool
+ */
+#pragma once
+#ifndef SRC_COCLASSES_ACTOR_H_
+#define SRC_COCLASSES_ACTOR_H_
+
+#include "mpsc_queue.h"
+#include "task.h"
+#include "thread_pool.h"
+#include "with_queue.h"
+
+#include <atomic>
+#include <optional>
+
+namespace cocls {
+
+///Mailbox of an actor
+/**
+ * Lock-free multiple producers single consumer queue. The consumer is the actor
+ * coroutine, which reads messages by co_yield {}.
+ *
+ * When the mailbox is empty, the actor is parked and it doesn't occupy any worker. The
+ * first message pushed to the parked actor's mailbox schedules the actor to the thread pool.
+ * Scheduled actor processes up to `batch` messages in one turn, then it is rescheduled
+ * to the end of thread pool's queue to give a chance to other actors.
+ *
+ * Idle actor costs only its coroutine frame, so it is possible to have millions of
+ * mostly idle actors.
+ *
+ * @tparam T type of message
+ */
+template<typename T>
+class actor_mailbox {
+public:
+
+    actor_mailbox():_queue(true) {}
+    actor_mailbox(const actor_mailbox &) = delete;
+    actor_mailbox &operator=(const actor_mailbox &) = delete;
+    ~actor_mailbox() {
+        while (auto n = _queue.pop()) {
+            delete static_cast<node *>(n);
+        }
+    }
+
+    ///Bind the mailbox to the thread pool
+    /**
+     * @param pool thread pool, where actor is scheduled
+     * @param batch maximum count of messages processed in one turn
+     *
+     * @note must be called before first message is pushed
+     */
+    void bind(thread_pool &pool, unsigned int batch) {
+        _pool = &pool;
+        _batch = batch?batch:1;
+        _budget = _batch;
+    }
+
+    ///push message (MT Safe)
+    void push(T &&t) {
+        push_node(new node(std::move(t)));
+    }
+    ///push message (MT Safe)
+    void push(const T &t) {
+        push_node(new node(t));
+    }
+
+    class pop_awaiter {
+    public:
+        pop_awaiter(actor_mailbox &owner):_owner(owner) {}
+        pop_awaiter(const pop_awaiter &) = delete;
+        pop_awaiter &operator=(const pop_awaiter &) = delete;
+        ~pop_awaiter() {
+            delete _n;
+        }
+
+        bool await_ready() {
+            _n = _owner.take();
+            if (_n && _owner._budget) {
+                --_owner._budget;
+                return true;
+            }
+            return false;
+        }
+        bool await_suspend(std::coroutine_handle<> h) {
+            _owner._h = h;
+            if (!_n) {
+                //mailbox is empty, try to park
+                if (_owner._queue.try_idle()) return true;
+                //new messages arrived
+                _n = _owner.take();
+                if (_owner._budget) {
+                    --_owner._budget;
+                    return false;
+                }
+            }
+            //turn is over, reschedule
+            _owner.schedule();
+            return true;
+        }
+        T await_resume() {
+            if (!_n) {
+                //resumed after park, new turn
+                _owner._budget = _owner._batch;
+                _n = _owner.take();
+                --_owner._budget;
+            } else if (_owner._budget == 0) {
+                //resumed after reschedule, new turn
+                _owner._budget = _owner._batch - 1;
+            }
+            return std::move(_n->_value);
+        }
+
+    protected:
+        actor_mailbox &_owner;
+        typename actor_mailbox::node *_n = nullptr;
+    };
+
+    ///Read next message, use co_yield {}
+    pop_awaiter pop() {
+        return *this;
+    }
+
+protected:
+
+    struct node: public abstract_awaiter, public coro_promise_base {
+        T _value;
+        template<typename X>
+        node(X &&x):_value(std::forward<X>(x)) {}
+        virtual void resume() noexcept override {}
+    };
+
+    mpsc_queue _queue;
+    thread_pool *_pool = nullptr;
+    std::coroutine_handle<> _h;
+    unsigned int _batch = 1;
+    unsigned int _budget = 1;
+
+    node *take() {
+        return static_cast<node *>(_queue.pop());
+    }
+
+    void push_node(node *n) {
+        if (_queue.push(n)) {
+            //synchronize with try_idle() to see _h
+            std::atomic_thread_fence(std::memory_order_acquire);
+            schedule();
+        }
+    }
+
+    void schedule() {
+        if (_pool) _pool->resume(_h);
+        else _h.resume();
+    }
+
+};
+
+///Actor - coroutine with mailbox hosted on thread pool
+/**
+ * The actor reads messages from its mailbox by co_yield {}. It is resumed in the thread
+ * pool. The actor must be started by start_actor()
+ *
+ * @code
+ * cocls::actor<int> counter_actor(int &sum) {
+ *      for(;;) {
+ *          int v = co_yield {};
+ *          if (v == 0) break;
+ *          sum += v;
+ *      }
+ * }
+ *
+ * auto a = counter_actor(sum);
+ * cocls::start_actor(a, pool);
+ * a.push(10);
+ * @endcode
+ *
+ * @note the actor coroutine starts immediately and runs until it reads the mailbox. Don't
+ * push messages after actor exited.
+ *
+ * @tparam T type of message
+ */
+template<typename T>
+using actor = with_queue<task<void>, T, actor_mailbox<T> >;
+
+///Bind actor to thread pool
+/**
+ * @param a actor
+ * @param pool thread pool, where actor is scheduled
+ * @param batch maximum count of messages processed in one turn
+ */
+template<typename T>
+void start_actor(actor<T> &a, thread_pool &pool, unsigned int batch = 16) {
+    a.get_queue().bind(pool, batch);
+}
+
+}
+
+#endif /* SRC_COCLASSES_ACTOR_H_ */
@@ -0,0 +1,291 @@
+/**
+ * @file adaptive_limiter.h
+ *
+ * Adaptive concurrency limiter
+ */
+#pragma once
+#ifndef SRC_COCLASSES_ADAPTIVE_LIMITER_H_
+#define SRC_COCLASSES_ADAPTIVE_LIMITER_H_
+
+#include "future.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace cocls {
+
+///Limits count of operations in flight, the limit adapts to measured latency
+/**
+ * Caller obtains a permit by co_await acquire() before it starts an operation. When the
+ * operation finishes, the permit is released and the latency of the operation is used to
+ * adjust the limit. Callers exceeding the limit are suspended in FIFO order.
+ *
+ * Available algorithms
+ *
+ * - **aimd** - additive increase, multiplicative decrease. The limit grows by one for every
+ *   successful operation and it is multiplied by backoff when an operation is dropped or
+ *   its latency exceeds the timeout
+ * - **gradient** - compares latency of every operation with long term average latency. When
+ *   the latency grows (queue builds up in the downstream), the limit is reduced proportionally.
+ *   Otherwise it grows by square root of the limit. Dropped operations apply backoff
+ *
+ * The limit grows only when at least half of the limit is used, so an idle client doesn't
+ * inflate the limit.
+ *
+ * @code
+ * cocls::adaptive_limiter limiter;
+ *
+ * cocls::task<> fanout(cocls::adaptive_limiter &limiter, client &c) {
+ *      int r = co_await limiter.run([&]{return c.call();});
+ * }
+ * @endcode
+ *
+ * @note the limiter must outlive all permits. Destruction of the limiter cancels all waiters
+ * (await_canceled_exception)
+ */
+class adaptive_limiter {
+public:
+
+    using clock = std::chrono::steady_clock;
+
+    enum class algorithm {
+        aimd,
+        gradient
+    };
+
+    struct options {
+        ///algorithm
+        algorithm algo = algorithm::gradient;
+        ///initial limit
+        double initial_limit = 20;
+        ///minimal limit
+        double min_limit = 1;
+        ///maximal limit
+        double max_limit = 1000;
+        ///multiplier applied to the limit on dropped operation
+        double backoff = 0.9;
+        ///aimd - latency considered as overload (zero - disabled)
+        std::chrono::nanoseconds timeout = std::chrono::nanoseconds(0);
+        ///gradient - tolerated ratio of the latency and long term latency
+        double tolerance = 1.5;
+        ///gradient - count of samples of long term average latency
+        double window = 600;
+        ///gradient - weight of the new limit (0..1)
+        double smoothing = 0.2;
+    };
+
+    ///Permission to run one operation
+    class permit {
+    public:
+        permit() = default;
+        permit(permit &&other):_owner(std::exchange(other._owner, nullptr)), _start(other._start) {}
+        permit &operator=(permit &&other) {
+            if (this != &other) {
+                release();
+                _owner = std::exchange(other._owner, nullptr);
+                _start = other._start;
+            }
+            return *this;
+        }
+        ///Releases the permit as successful operation
+        ~permit() {
+            release();
+        }
+
+        ///Operation finished successfully, its latency is measured
+        void release() {
+            finish(outcome::success);
+        }
+        ///Operation was dropped because of overload (timeout, rejected)
+        void drop() {
+            finish(outcome::dropped);
+        }
+        ///Operation failed for other reason, it is not measured
+        void ignore() {
+            finish(outcome::ignored);
+        }
+
+        ///Returns true if the permit is held
+        explicit operator bool() const {return _owner != nullptr;}
+
+    protected:
+        adaptive_limiter *_owner = nullptr;
+        clock::time_point _start;
+
+        explicit permit(adaptive_limiter *owner):_owner(owner), _start(clock::now()) {}
+
+        void finish(int o) {
+            if (_owner) {
+                std::exchange(_owner, nullptr)->on_release(clock::now() - _start, o);
+            }
+        }
+
+        friend class adaptive_limiter;
+    };
+
+    ///Construct limiter with default options
+    adaptive_limiter():adaptive_limiter(options()) {}
+
+    ///Construct limiter
+    explicit adaptive_limiter(const options &opt)
+        :_opt(opt)
+        ,_limit(std::clamp(opt.initial_limit, std::max(opt.min_limit, 1.0), opt.max_limit)) {}
+
+    adaptive_limiter(const adaptive_limiter &) = delete;
+    adaptive_limiter &operator=(const adaptive_limiter &) = delete;
+
+    ~adaptive_limiter() {
+        std::deque<promise<permit> > q;
+        {
+            std::lock_guard _(_mx);
+            _closed = true;
+            std::swap(q, _queue);
+        }
+        for (auto &p: q) {
+            p(std::make_exception_ptr(await_canceled_exception()));
+        }
+    }
+
+    ///Acquire permit
+    /**
+     * @return future with the permit. If the limit is not reached, the future is already
+     * resolved
+     */
+    unique_future<permit> acquire() {
+        return [&](auto promise) {
+            std::unique_lock lk(_mx);
+            if (_closed) {
+                lk.unlock();
+                promise(std::make_exception_ptr(await_canceled_exception()));
+            } else if (_queue.empty() && _in_flight < current_limit()) {
+                ++_in_flight;
+                lk.unlock();
+                promise(permit(this));
+            } else {
+                _queue.push_back(std::move(promise));
+            }
+        };
+    }
+
+    ///Acquire permit without waiting
+    /**
+     * @return permit or no value if the limit is reached
+     */
+    std::optional<permit> try_acquire() {
+        std::lock_guard _(_mx);
+        if (_closed || !_queue.empty() || _in_flight >= current_limit()) return {};
+        ++_in_flight;
+        return permit(this);
+    }
+
+    ///Run operation under the limiter
+    /**
+     * @param fn function which starts the operation and returns a future
+     * @return future with result of the operation. If the operation throws an exception
+     * it is considered as dropped
+     */
+    template<typename Fn>
+    auto run(Fn fn) -> future<typename _details::IsFuture<std::decay_t<decltype(fn())> >::Type> {
+        using T = typename _details::IsFuture<std::decay_t<decltype(fn())> >::Type;
+        permit p = co_await acquire();
+        try {
+            if constexpr(std::is_void_v<T>) {
+                co_await fn();
+                p.release();
+            } else {
+                T r = std::move(co_await fn());
+                p.release();
+                co_return std::move(r);
+            }
+        } catch (...) {
+            p.drop();
+            throw;
+        }
+    }
+
+    ///Returns current limit
+    std::size_t limit() const {
+        std::lock_guard _(_mx);
+        return current_limit();
+    }
+
+    ///Returns count of operations in flight
+    std::size_t in_flight() const {
+        std::lock_guard _(_mx);
+        return _in_flight;
+    }
+
+    ///Returns count of waiting callers
+    std::size_t waiting() const {
+        std::lock_guard _(_mx);
+        return _queue.size();
+    }
+
+protected:
+
+    struct outcome {
+        static constexpr int success = 0;
+        static constexpr int dropped = 1;
+        static constexpr int ignored = 2;
+    };
+
+    options _opt;
+    mutable std::mutex _mx;
+    double _limit;
+    //long term average latency (ns)
+    double _long_rtt = 0;
+    std::size_t _in_flight = 0;
+    std::deque<promise<permit> > _queue;
+    bool _closed = false;
+
+    std::size_t current_limit() const {
+        return static_cast<std::size_t>(_limit);
+    }
+
+    void on_release(clock::duration rtt, int o) {
+        std::vector<promise<permit> > ready;
+        {
+            std::lock_guard _(_mx);
+            //count of operations in flight, including this one
+            std::size_t used = _in_flight--;
+            if (o == outcome::success) update(std::chrono::duration<double, std::nano>(rtt).count(), used);
+            else if (o == outcome::dropped) _limit *= _opt.backoff;
+            _limit = std::clamp(_limit, std::max(_opt.min_limit, 1.0), _opt.max_limit);
+            while (!_queue.empty() && _in_flight < current_limit()) {
+                ++_in_flight;
+                ready.push_back(std::move(_queue.front()));
+                _queue.pop_front();
+            }
+        }
+        for (auto &p: ready) p(permit(this));
+    }
+
+    void update(double rtt, std::size_t used) {
+        bool app_limited = used * 2 < _limit;
+        if (_opt.algo == algorithm::aimd) {
+            if (_opt.timeout.count() && rtt > static_cast<double>(_opt.timeout.count())) {
+                _limit *= _opt.backoff;
+            } else if (!app_limited) {
+                _limit += 1.0;
+            }
+        } else {
+            if (_long_rtt == 0) _long_rtt = rtt;
+            else _long_rtt += (rtt - _long_rtt) / _opt.window;
+            //downstream recovered faster then the average, let the average follow
+            if (_long_rtt > rtt * 2) _long_rtt *= 0.95;
+            if (app_limited) return;
+            double gradient = std::clamp(_opt.tolerance * _long_rtt / std::max(rtt, 1.0), 0.5, 1.0);
+            double new_limit = _limit * gradient + std::sqrt(_limit);
+            _limit = _limit * (1.0 - _opt.smoothing) + new_limit * _opt.smoothing;
+        }
+    }
+};
+
+}
+
+#endif /* SRC_COCLASSES_ADAPTIVE_LIMITER_H_ */
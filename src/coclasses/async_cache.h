@@ -0,0 +1,251 @@
+/**
+ * @file async_cache.h
+ *
+ * Cache of asynchronously loaded values
+ */
+#pragma once
+#ifndef SRC_COCLASSES_ASYNC_CACHE_H_
+#define SRC_COCLASSES_ASYNC_CACHE_H_
+
+#include "future.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace cocls {
+
+///Cache of asynchronously loaded values with single-flight loading
+/**
+ * The function get() returns shared_future with the value. If the value is cached, the
+ * future is already resolved, so co_await doesn't suspend. If the value is missing, the
+ * loader is called. Concurrent requests for the same key share the load in progress,
+ * so the loader is called only once.
+ *
+ * Values expire after TTL. The cache is divided to shards, each shard has own lock and
+ * own LRU list, the count of entries is limited per shard. The lock is held only during
+ * lookup, it is never held while the loader runs.
+ *
+ * Failed loads are not cached. All current waiters receive the exception and the next
+ * request for the key starts new load.
+ *
+ * @code
+ * cocls::async_cache<std::string, user> cache(10000, std::chrono::seconds(60));
+ *
+ * cocls::task<> handle(cocls::async_cache<std::string, user> &cache, std::string id) {
+ *      user u = co_await cache.get(id, [&](const std::string &id){return db.load_user(id);});
+ * }
+ * @endcode
+ *
+ * @tparam K type of key
+ * @tparam V type of value
+ * @tparam Hash hash function
+ * @tparam Equal key comparison
+ *
+ * @note the cache must outlive all pending loads.
+ */
+template<typename K, typename V, typename Hash = std::hash<K>, typename Equal = std::equal_to<K> >
+class async_cache {
+public:
+
+    using clock = std::chrono::steady_clock;
+
+    ///Construct the cache
+    /**
+     * @param max_entries maximum count of entries
+     * @param ttl time to live of loaded value
+     * @param shards count of shards (rounded up to power of two)
+     */
+    explicit async_cache(std::size_t max_entries, clock::duration ttl = clock::duration::max(), unsigned int shards = 16)
+        :_ttl(ttl)
+        ,_nshards(std::bit_ceil(std::max(shards, 1U)))
+        ,_shards(std::make_unique<shard[]>(_nshards)) {
+        std::size_t cap = (std::max<std::size_t>(max_entries, 1) + _nshards - 1) / _nshards;
+        for (unsigned int i = 0; i < _nshards; i++) _shards[i]._cap = cap;
+    }
+
+    async_cache(const async_cache &) = delete;
+    async_cache &operator=(const async_cache &) = delete;
+
+    ///Retrieve value, load it if it is not cached
+    /**
+     * @param key key
+     * @param loader function which starts load of the value. It can accept the key, it
+     * must return future<V>. It is called only when the value is missing and no other load
+     * is in progress
+     * @return shared future with the value. It is already resolved if the value is
+     * cached.
+     */
+    template<typename Fn>
+    shared_future<V> get(const K &key, Fn &&loader) {
+        shard &s = get_shard(key);
+        shared_future<V> res;
+        promise<V> p;
+        std::uint64_t id;
+        {
+            std::lock_guard _(s._mx);
+            auto iter = s._map.find(key);
+            if (iter != s._map.end()) {
+                entry &e = iter->second;
+                if (e._expires > clock::now()) {
+                    s._lru.splice(s._lru.begin(), s._lru, e._lru);
+                    return e._fut;
+                }
+                s._lru.erase(e._lru);
+                s._map.erase(iter);
+            }
+            res = shared_future<V>([&](auto prom){p = std::move(prom);});
+            id = ++s._next_id;
+            s._lru.push_front(key);
+            s._map.emplace(key, entry{res, clock::time_point::max(), s._lru.begin(), id});
+            trim(s);
+        }
+        auto op = new load_op(*this, s, key, id, std::move(p));
+        op->_f << [&]{
+            if constexpr(std::is_invocable_v<Fn, const K &>) return loader(key);
+            else return loader();
+        };
+        if (!op->_f.subscribe(op)) op->resume();
+        return res;
+    }
+
+    ///Remove the key from the cache
+    /**
+     * @param key key to remove
+     * @retval true removed
+     * @retval false not found
+     *
+     * @note load in progress is not canceled, but its result is not stored
+     */
+    bool invalidate(const K &key) {
+        shard &s = get_shard(key);
+        std::lock_guard _(s._mx);
+        auto iter = s._map.find(key);
+        if (iter == s._map.end()) return false;
+        s._lru.erase(iter->second._lru);
+        s._map.erase(iter);
+        return true;
+    }
+
+    ///Remove all entries
+    void clear() {
+        for (unsigned int i = 0; i < _nshards; i++) {
+            shard &s = _shards[i];
+            std::lock_guard _(s._mx);
+            s._map.clear();
+            s._lru.clear();
+        }
+    }
+
+    ///Returns count of entries (including pending loads)
+    std::size_t size() const {
+        std::size_t cnt = 0;
+        for (unsigned int i = 0; i < _nshards; i++) {
+            const shard &s = _shards[i];
+            std::lock_guard _(s._mx);
+            cnt += s._map.size();
+        }
+        return cnt;
+    }
+
+protected:
+
+    using lru_list = std::list<K>;
+
+    struct entry {
+        shared_future<V> _fut;
+        clock::time_point _expires;
+        typename lru_list::iterator _lru;
+        std::uint64_t _id;
+    };
+
+    struct alignas(64) shard {
+        mutable std::mutex _mx;
+        std::unordered_map<K, entry, Hash, Equal> _map;
+        lru_list _lru;
+        std::size_t _cap = 1;
+        std::uint64_t _next_id = 0;
+    };
+
+    //pending load, deletes itself when the load finishes
+    struct load_op: public abstract_awaiter {
+        load_op(async_cache &owner, shard &s, const K &key, std::uint64_t id, promise<V> &&p)
+            :_owner(owner), _shard(s), _key(key), _id(id), _p(std::move(p)) {}
+
+        async_cache &_owner;
+        shard &_shard;
+        K _key;
+        std::uint64_t _id;
+        promise<V> _p;
+        future<V> _f;
+
+        virtual void resume() noexcept override {
+            _owner.finish_load(*this);
+            delete this;
+        }
+    };
+
+    clock::duration _ttl;
+    unsigned int _nshards;
+    std::unique_ptr<shard[]> _shards;
+
+    shard &get_shard(const K &key) {
+        std::size_t h = Hash()(key);
+        //mix bits, std::hash is often identity (splitmix64 finalizer)
+        h ^= h >> 30;
+        h *= 0xBF58476D1CE4E5B9ULL;
+        h ^= h >> 27;
+        h *= 0x94D049BB133111EBULL;
+        h ^= h >> 31;
+        return _shards[h & (_nshards - 1)];
+    }
+
+    clock::time_point expiration() const {
+        auto now = clock::now();
+        if (_ttl >= clock::time_point::max() - now) return clock::time_point::max();
+        return now + _ttl;
+    }
+
+    //under lock
+    static void trim(shard &s) {
+        while (s._map.size() > s._cap) {
+            s._map.erase(s._lru.back());
+            s._lru.pop_back();
+        }
+    }
+
+    void finish_load(load_op &op) {
+        std::exception_ptr e;
+        try {
+            op._f.value();
+        } catch (...) {
+            e = std::current_exception();
+        }
+        {
+            shard &s = op._shard;
+            std::lock_guard _(s._mx);
+            auto iter = s._map.find(op._key);
+            //entry could be invalidated or replaced meanwhile
+            if (iter != s._map.end() && iter->second._id == op._id) {
+                if (e) {
+                    s._lru.erase(iter->second._lru);
+                    s._map.erase(iter);
+                } else {
+                    iter->second._expires = expiration();
+                }
+            }
+        }
+        if (e) op._p(e);
+        else op._p(std::move(op._f.value()));
+    }
+};
+
+}
+
+#endif /* SRC_COCLASSES_ASYNC_CACHE_H_ */
@@ -5,12 +5,14 @@
 
 #include "resumption_policy.h"
 #include "queued_resumption_policy.h"
+#include "trace.h"
 
 #include <algorithm>
 #include <coroutine>
 #include <atomic>
 #include <cassert>
 #include <memory>
+#include <thread>
 
 namespace cocls {
 
@@ -77,8 +79,19 @@ public:
     static std::size_t resume_chain_set_ready(std::atomic<abstract_awaiter *> &chain, abstract_awaiter &ready_state, abstract_awaiter *skip) {
         //acquire memory order, we need to see modifications made by other thread during registration
         //this is first operation of the thread of awaiters
-        return resume_chain_lk(chain.exchange(&ready_state, std::memory_order_acquire), skip);
+        abstract_awaiter *x = chain.exchange(&ready_state, std::memory_order_acquire);
+        //chain is held by unsubscribe_check_ready(), which resumes it
+        if (x == lock_state()) return 0;
+        return resume_chain_lk(x, skip);
     }
+
+    ///State of a chain held by unsubscribe_check_ready()
+    /**
+     * Code which takes the chain by exchanging it with ready state must treat this
+     * state as an empty chain
+     */
+    static abstract_awaiter *lock_state() noexcept;
+
     static std::size_t resume_chain_lk(abstract_awaiter *chain, abstract_awaiter *skip) {
         std::size_t n = 0;
         while (chain) {
@@ -109,11 +122,61 @@ public:
                 chain.load(std::memory_order_acquire);
                 return false;
             }
+            if (_next == lock_state()) {
+                //chain is held by unsubscribe_check_ready() for a while
+                std::this_thread::yield();
+                _next = nullptr;
+            }
         }
         return true;
 
     }
 
+    ///remove this awaiter from the chain
+    /**
+     * Counterpart of subscribe_check_ready(). The function takes whole chain, replacing
+     * it by lock_state(), removes this awaiter and returns remaining awaiters back.
+     * Registrations wait while the chain is held. If the chain has been marked ready
+     * meanwhile, remaining awaiters are resumed here. If the awaiter is not subscribed,
+     * the chain is left unchanged and the function returns false
+     *
+     * @param chain chain where the awaiter is registered
+     * @param ready_state state in meaning ready
+     * @retval true awaiter removed, it will not be resumed
+     * @retval false the chain is already released, the awaiter is being resumed, or
+     * the awaiter is not subscribed
+     */
+    bool unsubscribe_check_ready(std::atomic<abstract_awaiter *> &chain, abstract_awaiter &ready_state) {
+        abstract_awaiter *head = chain.load(std::memory_order_acquire);
+        for(;;) {
+            if (head == &ready_state) return false;
+            //empty chain, this awaiter is not subscribed
+            if (head == nullptr) return false;
+            if (head == lock_state()) {
+                //chain is held by other thread for a while
+                std::this_thread::yield();
+                head = chain.load(std::memory_order_acquire);
+            } else if (chain.compare_exchange_weak(head, lock_state(), std::memory_order_acquire)) {
+                break;
+            }
+        }
+        abstract_awaiter **p = &head;
+        while (*p && *p != this) p = &(*p)->_next;
+        bool found = *p != nullptr;
+        if (found) {
+            *p = _next;
+            _next = nullptr;
+        }
+        //nobody can register while the chain is held, it can be only marked ready
+        abstract_awaiter *cur = lock_state();
+        if (!chain.compare_exchange_strong(cur, head, std::memory_order_release, std::memory_order_acquire)) {
+            assert(cur == &ready_state);
+            //resolved while the chain was taken, nobody else can resume them
+            resume_chain_lk(head, nullptr);
+        }
+        return found;
+    }
+
     virtual std::coroutine_handle<> resume_handle() noexcept override {
         resume();
         return std::noop_coroutine();
@@ -140,6 +203,8 @@ public:
      * @see abstract_awaiter::resume_chain_set_disabled
      */
     static empty_awaiter disabled;
+    ///Marks chain held by abstract_awaiter::unsubscribe_check_ready()
+    static empty_awaiter locked;
 
     virtual void resume() noexcept override {}
     virtual std::coroutine_handle<> resume_handle() noexcept override {return std::noop_coroutine();}
@@ -152,6 +217,11 @@ public:
 
 inline empty_awaiter empty_awaiter::instance;
 inline empty_awaiter empty_awaiter::disabled;
+inline empty_awaiter empty_awaiter::locked;
+
+inline abstract_awaiter *abstract_awaiter::lock_state() noexcept {
+    return &empty_awaiter::locked;
+}
 
 
 ///Awaiter which carries and owner, base for many awaiters
@@ -198,9 +268,11 @@ protected:
     std::coroutine_handle<> _h;
 
     virtual std::coroutine_handle<> resume_handle() noexcept  override {
+        COCLS_TRACE1(awaiter_resume, _h.address());
         return _h;
     }
     virtual void resume() noexcept  override {
+        COCLS_TRACE1(awaiter_resume, _h.address());
         resumption_policy::unspecified<void>::policy::resume(_h);
     }
 
@@ -297,6 +369,7 @@ public:
     virtual void resume() noexcept override  {
         try {
             assert("Attempt to resume still pending awaiter" && this->_next == nullptr);
+            COCLS_TRACE1(awaiter_resume, super::_h.address());
             _p.resume(super::_h);
         } catch (...) {
             _resume_exception = std::current_exception();
@@ -306,6 +379,7 @@ public:
     virtual std::coroutine_handle<> resume_handle() noexcept override {
         try {
             assert("Attempt to resume still pending awaiter" && this->_next == nullptr);
+            COCLS_TRACE1(awaiter_resume, super::_h.address());
             return _p.resume_handle(super::_h);
         } catch (...) {
             _resume_exception = std::current_exception();
@@ -330,20 +404,57 @@ inline decltype(auto) co_awaiter<promise_type>::wait() {
     return await_resume();
 }
 
+///Allows to a thread to process other work while it is waiting synchronously
+/**
+ * A thread which can process other work (for example worker of thread_pool) installs
+ * the helper into wait_helper::current. Then any synchronous wait performed in
+ * this thread is handled by the helper.
+ */
+class wait_helper {
+public:
+    virtual ~wait_helper() = default;
+
+    ///Process other work until flag is set
+    /**
+     * @param flag flag to wait on. The flag is set by notify()
+     */
+    virtual void help_until(std::atomic<bool> &flag) noexcept = 0;
+    ///Set the flag and wake up the waiting thread
+    /**
+     * @param flag flag passed to help_until()
+     *
+     * @note the waiting thread can continue immediately when flag is set, so this
+     * function must not access the flag after it is set.
+     */
+    virtual void notify(std::atomic<bool> &flag) noexcept = 0;
+
+    ///helper of current thread, can be nullptr
+    static thread_local wait_helper *current;
+};
+
+inline thread_local wait_helper *wait_helper::current = nullptr;
+
 class sync_awaiter: public abstract_awaiter {
 public:
     std::atomic<bool> flag = {false};
+    ///helper used to wait, can be nullptr
+    wait_helper *helper = nullptr;
 
     virtual std::coroutine_handle<> resume_handle() noexcept override {
         sync_awaiter::resume();
         return std::noop_coroutine();
     }
     virtual void resume() noexcept override {
-        flag.store(true);
-        flag.notify_all();
+        if (helper) {
+            helper->notify(flag);
+        } else {
+            flag.store(true);
+            flag.notify_all();
+        }
     }
     void wait_sync() {
-        flag.wait(false);
+        if (helper) helper->help_until(flag);
+        else flag.wait(false);
     }
 };
 
@@ -352,8 +463,9 @@ template<typename promise_type>
 inline void co_awaiter<promise_type>::sync() noexcept  {
     if (await_ready()) return ;
     sync_awaiter awt;
+    awt.helper = wait_helper::current;
     if (subscribe_awaiter(&awt)) {
-        awt.flag.wait(false);
+        awt.wait_sync();
     }
 
 }
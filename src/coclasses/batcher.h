@@ -0,0 +1,205 @@
+/**
+ * @file batcher.h
+ *
+ * Aggregates individual requests to batches
+ */
+#pragma once
+#ifndef SRC_COCLASSES_BATCHER_H_
+#define SRC_COCLASSES_BATCHER_H_
+
+#include "future.h"
+#include "scheduler.h"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace cocls {
+
+///Thrown when the batch function returns different count of responses than count of requests
+class batch_size_mismatch_exception: public std::exception {
+public:
+    const char *what() const noexcept override {
+        return "Batch function returned unexpected count of responses";
+    }
+};
+
+///Collects individual requests to batches
+/**
+ * Callers submit single requests by co_await submit(req). The requests are collected
+ * to a batch. The batch is processed by the batch function when it reaches maximum
+ * size or when maximum delay expires since the first request of the batch. Each caller
+ * receives its own response from the result of the batch
+ *
+ * There is at most one open batch and it has one timer in the scheduler, regardless on
+ * count of requests. The timer is canceled when the batch is closed by its size. The batch
+ * function can process more batches at the same time.
+ *
+ * @code
+ * cocls::batcher<record, bool> writer(sch, [&](std::vector<record> &&recs) {
+ *      return storage.write_batch(std::move(recs));
+ * }, 100, std::chrono::milliseconds(2));
+ *
+ * bool ok = co_await writer.submit(rec);
+ * @endcode
+ *
+ * @tparam Req type of request
+ * @tparam Resp type of response
+ *
+ * @note scheduler must outlive the batcher. Destruction of the batcher processes the
+ * open batch immediately
+ */
+template<typename Req, typename Resp>
+class batcher {
+public:
+
+    ///Batch function. Receives requests and returns future with responses in the same order
+    using batch_function = std::function<future<std::vector<Resp> >(std::vector<Req> &&)>;
+
+    ///Construct the batcher
+    /**
+     * @param sch scheduler used for max delay
+     * @param fn batch function
+     * @param max_size maximum count of requests in the batch
+     * @param max_delay maximum delay of the first request of the batch
+     */
+    template<typename A, typename B>
+    batcher(scheduler &sch, batch_function fn, std::size_t max_size, std::chrono::duration<A,B> max_delay)
+        :_state(std::make_shared<state>(sch, std::move(fn), max_size,
+                std::chrono::duration_cast<std::chrono::nanoseconds>(max_delay))) {}
+
+    batcher(const batcher &) = delete;
+    batcher &operator=(const batcher &) = delete;
+
+    ~batcher() {
+        _state->close();
+    }
+
+    ///Submit a request
+    /**
+     * @param req request
+     * @return future with the response. If the batch function throws an exception, the
+     * exception is passed to all callers of the batch.
+     */
+    future<Resp> submit(Req req) {
+        return [&](auto promise) {
+            _state->add(std::move(req), std::move(promise));
+        };
+    }
+
+    ///Process the open batch now
+    void flush() {
+        _state->flush();
+    }
+
+protected:
+
+    struct batch {
+        std::vector<Req> _reqs;
+        std::vector<promise<Resp> > _promises;
+    };
+
+    //running batch, deletes itself when the batch function finishes
+    struct pending_batch: public abstract_awaiter {
+        std::vector<promise<Resp> > _promises;
+        future<std::vector<Resp> > _f;
+
+        virtual void resume() noexcept override {
+            try {
+                auto &res = _f.value();
+                if (res.size() != _promises.size()) throw batch_size_mismatch_exception();
+                for (std::size_t i = 0; i < res.size(); i++) _promises[i](std::move(res[i]));
+            } catch (...) {
+                for (auto &p: _promises) p(std::current_exception());
+            }
+            delete this;
+        }
+    };
+
+    class state: public std::enable_shared_from_this<state> {
+    public:
+        state(scheduler &sch, batch_function &&fn, std::size_t max_size, std::chrono::nanoseconds max_delay)
+            :_sch(sch), _fn(std::move(fn)), _max_size(std::max<std::size_t>(max_size, 1)), _max_delay(max_delay) {}
+
+        void add(Req &&req, promise<Resp> &&p) {
+            //removed timer is dropped outside of the lock
+            scheduler::promise tm;
+            std::unique_lock lk(_mx);
+            _open._reqs.push_back(std::move(req));
+            _open._promises.push_back(std::move(p));
+            if (_open._reqs.size() >= _max_size) {
+                batch b = take();
+                tm = _sch.remove(_timer);
+                lk.unlock();
+                run(std::move(b));
+            } else if (_open._reqs.size() == 1) {
+                _sch.schedule(_timer, make_promise<void>([me = this->shared_from_this(), gen = _gen](future<void> &f){
+                    me->on_timer(f, gen);
+                }), std::chrono::system_clock::now() + _max_delay);
+            }
+        }
+
+        void flush() {
+            scheduler::promise tm;
+            std::unique_lock lk(_mx);
+            if (_open._reqs.empty()) return;
+            batch b = take();
+            tm = _sch.remove(_timer);
+            lk.unlock();
+            run(std::move(b));
+        }
+
+        void close() {
+            flush();
+        }
+
+    protected:
+        scheduler &_sch;
+        batch_function _fn;
+        std::size_t _max_size;
+        std::chrono::nanoseconds _max_delay;
+        std::mutex _mx;
+        batch _open;
+        //generation of the open batch, stale timers are ignored
+        std::uint64_t _gen = 0;
+        scheduler::timer _timer;
+
+        //under lock
+        batch take() {
+            batch b = std::move(_open);
+            _open = {};
+            ++_gen;
+            return b;
+        }
+
+        void on_timer(future<void> &f, std::uint64_t gen) {
+            try {
+                f.value();
+            } catch (...) {
+                //canceled
+                return;
+            }
+            std::unique_lock lk(_mx);
+            if (gen != _gen || _open._reqs.empty()) return;
+            batch b = take();
+            lk.unlock();
+            run(std::move(b));
+        }
+
+        void run(batch &&b) {
+            auto op = new pending_batch;
+            op->_promises = std::move(b._promises);
+            op->_f << [&]{return _fn(std::move(b._reqs));};
+            if (!op->_f.subscribe(op)) op->resume();
+        }
+    };
+
+    std::shared_ptr<state> _state;
+};
+
+}
+
+#endif /* SRC_COCLASSES_BATCHER_H_ */
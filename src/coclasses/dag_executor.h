@@ -0,0 +1,252 @@
+/**
+ * @file dag_executor.h
+ *
+ * Executor of tasks with dependencies
+ */
+#pragma once
+#ifndef SRC_COCLASSES_DAG_EXECUTOR_H_
+#define SRC_COCLASSES_DAG_EXECUTOR_H_
+
+#include "future.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cocls {
+
+///Executes graph of tasks with dependencies
+/**
+ * Nodes are added with list of nodes, which they depend on. A dependency must be added
+ * before the node, so the graph is always acyclic. Every node has atomic counter of
+ * unfinished dependencies, the node becomes ready when the last dependency finishes
+ * and it is started on the thread pool immediately, unless the limit of running nodes
+ * is reached.
+ *
+ * Ready nodes are started in order of their priority, which is the length of the longest
+ * path to the end of the graph (sum of costs). So nodes on the critical path are started
+ * first.
+ *
+ * When a node fails, nodes depending on it are not started, they are marked skipped. Other
+ * branches of the graph continue. The first exception is reported when the graph finishes.
+ *
+ * @code
+ * cocls::dag_executor dag;
+ * auto a = dag.add([]{compile("a.cpp");});
+ * auto b = dag.add([]{compile("b.cpp");});
+ * dag.add([]{link("app");}, {a, b});
+ * co_await dag.run(pool);
+ * @endcode
+ *
+ * @note the executor can be run only once. It must not be destroyed while it is running
+ */
+class dag_executor {
+public:
+
+    using node_id = std::size_t;
+
+    enum class status {
+        ///not started yet
+        pending,
+        ///running
+        running,
+        ///finished successfully
+        done,
+        ///failed (exception)
+        failed,
+        ///not started, because a dependency failed
+        skipped
+    };
+
+    dag_executor() = default;
+    dag_executor(const dag_executor &) = delete;
+    dag_executor &operator=(const dag_executor &) = delete;
+
+    ///Add a node
+    /**
+     * @param fn function to execute. It can return void or future<void>
+     * @param deps list of nodes which must finish before this node is started
+     * @param cost estimated cost of the node, used to find the critical path
+     * @return identifier of the node
+     */
+    template<typename Fn>
+    node_id add(Fn &&fn, const std::vector<node_id> &deps = {}, double cost = 1.0) {
+        node_id id = _nodes.size();
+        node &n = _nodes.emplace_back(*this, id, wrap(std::forward<Fn>(fn)), cost);
+        for (node_id d: deps) {
+            assert("Dependency must be added before the node" && d < id);
+            _nodes[d]._succ.push_back(id);
+            ++n._deps;
+        }
+        return id;
+    }
+
+    ///Run the graph
+    /**
+     * @param pool thread pool
+     * @param max_parallel maximum count of running nodes. Default value is count of CPU cores
+     * @return future which is resolved when all nodes are finished or skipped. If
+     * any node failed, the future contains its exception
+     */
+    future<void> run(thread_pool &pool, unsigned int max_parallel = 0) {
+        return [&](auto promise) {
+            _pool = &pool;
+            _max_parallel = max_parallel?max_parallel:std::max(std::thread::hardware_concurrency(), 1U);
+            _done = std::move(promise);
+            //ids are in topological order, so ranks are calculated backwards
+            for (std::size_t i = _nodes.size(); i-- > 0;) {
+                node &n = _nodes[i];
+                double r = 0;
+                for (node_id s: n._succ) r = std::max(r, _nodes[s]._rank);
+                n._rank = n._cost + r;
+                n._remaining.store(n._deps, std::memory_order_relaxed);
+            }
+            std::vector<node *> ready;
+            for (auto &n: _nodes) if (n._deps == 0) ready.push_back(&n);
+            schedule(ready, 0, nullptr);
+        };
+    }
+
+    ///Retrieve status of the node
+    status get_status(node_id id) const {
+        return _nodes[id]._status.load(std::memory_order_acquire);
+    }
+
+    ///Returns count of nodes
+    std::size_t size() const {
+        return _nodes.size();
+    }
+
+protected:
+
+    using function = std::function<future<void>()>;
+
+    struct node: public abstract_awaiter {
+        node(dag_executor &owner, node_id id, function &&fn, double cost)
+            :_owner(owner), _id(id), _fn(std::move(fn)), _cost(cost) {}
+
+        dag_executor &_owner;
+        node_id _id;
+        function _fn;
+        double _cost;
+        double _rank = 0;
+        std::vector<node_id> _succ;
+        unsigned int _deps = 0;
+        std::atomic<unsigned int> _remaining = 0;
+        std::atomic<bool> _poisoned = false;
+        std::atomic<status> _status = status::pending;
+        future<void> _f;
+
+        virtual void resume() noexcept override {
+            _owner.on_finished(*this);
+        }
+    };
+
+    static bool compare_rank(const node *a, const node *b) {
+        return a->_rank < b->_rank;
+    }
+
+    std::deque<node> _nodes;
+    thread_pool *_pool = nullptr;
+    unsigned int _max_parallel = 1;
+    std::mutex _mx;
+    //ready nodes, heap ordered by rank
+    std::vector<node *> _ready;
+    unsigned int _running = 0;
+    std::size_t _finished = 0;
+    std::exception_ptr _exception;
+    promise<void> _done;
+
+    template<typename Fn>
+    static function wrap(Fn &&fn) {
+        if constexpr(std::is_void_v<std::invoke_result_t<Fn &> >) {
+            return [fn = std::forward<Fn>(fn)]() mutable -> future<void> {
+                fn();
+                return future<void>::set_value();
+            };
+        } else {
+            return function(std::forward<Fn>(fn));
+        }
+    }
+
+    void execute(node &n) {
+        n._status.store(status::running, std::memory_order_relaxed);
+        n._f << [&]{return n._fn();};
+        if (!n._f.subscribe(&n)) on_finished(n);
+    }
+
+    void on_finished(node &n) {
+        std::exception_ptr e;
+        try {
+            n._f.value();
+        } catch (...) {
+            e = std::current_exception();
+        }
+        n._status.store(e?status::failed:status::done, std::memory_order_release);
+        //release dependents, skip dependents of failed nodes
+        std::vector<node *> ready;
+        std::vector<node *> work = {&n};
+        std::size_t finished = 1;
+        while (!work.empty()) {
+            node *x = work.back();
+            work.pop_back();
+            bool bad = x->_status.load(std::memory_order_relaxed) != status::done;
+            for (node_id s: x->_succ) {
+                node &y = _nodes[s];
+                if (bad) y._poisoned.store(true, std::memory_order_relaxed);
+                if (y._remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    if (y._poisoned.load(std::memory_order_relaxed)) {
+                        y._status.store(status::skipped, std::memory_order_release);
+                        work.push_back(&y);
+                        ++finished;
+                    } else {
+                        ready.push_back(&y);
+                    }
+                }
+            }
+        }
+        schedule(ready, finished, e);
+    }
+
+    void schedule(std::vector<node *> &ready, std::size_t finished, std::exception_ptr e) {
+        std::vector<node *> start;
+        thread_pool *pool;
+        bool all_done;
+        {
+            std::lock_guard _(_mx);
+            if (e && !_exception) _exception = e;
+            for (node *x: ready) {
+                _ready.push_back(x);
+                std::push_heap(_ready.begin(), _ready.end(), compare_rank);
+            }
+            if (finished) _running--;
+            _finished += finished;
+            while (_running < _max_parallel && !_ready.empty()) {
+                std::pop_heap(_ready.begin(), _ready.end(), compare_rank);
+                start.push_back(_ready.back());
+                _ready.pop_back();
+                ++_running;
+            }
+            pool = _pool;
+            all_done = _finished == _nodes.size();
+            if (all_done) e = _exception;
+        }
+        for (node *x: start) {
+            pool->run_detached([x]{x->_owner.execute(*x);});
+        }
+        //the executor can be destroyed after this
+        if (all_done) {
+            if (e) _done(e); else _done();
+        }
+    }
+};
+
+}
+
+#endif /* SRC_COCLASSES_DAG_EXECUTOR_H_ */
@@ -0,0 +1,254 @@
+/**
+ * @file delay_queue.h
+ *
+ * Queue of items released at specified time
+ */
+#pragma once
+#ifndef SRC_COCLASSES_DELAY_QUEUE_H_
+#define SRC_COCLASSES_DELAY_QUEUE_H_
+
+#include "future.h"
+#include "priority_queue.h"
+#include "scheduler.h"
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace cocls {
+
+///Awaitable queue of items, which become available at specified time
+/**
+ * Items are pushed with the time when they become ready. Consumers co_await pop()
+ * and receive the next ready item. Items are ordered by the ready time, items with
+ * the same time are served in the order of pushing.
+ *
+ * The queue uses one timer in the scheduler regardless of count of pending items. The
+ * timer is set to the earliest ready time and only while a consumer is waiting.
+ *
+ * @code
+ * cocls::delay_queue<request> retries(sch);
+ *
+ * //producer
+ * retries.push(req, std::chrono::milliseconds(100) << req.attempt);
+ *
+ * //consumer
+ * request req = co_await retries.pop();
+ * @endcode
+ *
+ * @tparam T type of item
+ *
+ * @note scheduler must outlive the queue. Destruction of the queue drops the items
+ * and pending consumers receive an exception.
+ */
+template<typename T>
+class delay_queue {
+public:
+
+    using clock = std::chrono::system_clock;
+
+    ///Construct the queue
+    /**
+     * @param sch scheduler
+     */
+    explicit delay_queue(scheduler &sch):_state(std::make_shared<state>(sch)) {}
+
+    delay_queue(const delay_queue &) = delete;
+    delay_queue &operator=(const delay_queue &) = delete;
+
+    ~delay_queue() {
+        _state->close();
+    }
+
+    ///Push item
+    /**
+     * @param item item
+     * @param ready_at time when the item becomes ready
+     */
+    void push(T item, clock::time_point ready_at) {
+        _state->push(std::move(item), ready_at);
+    }
+
+    ///Push item
+    /**
+     * @param item item
+     * @param delay delay before the item becomes ready
+     */
+    template<typename A, typename B>
+    void push(T item, std::chrono::duration<A,B> delay) {
+        _state->push(std::move(item), clock::now() + std::chrono::duration_cast<clock::duration>(delay));
+    }
+
+    ///Pop the next ready item
+    /**
+     * @return future with the item. The future is resolved immediately, if there is
+     * a ready item.
+     */
+    future<T> pop() {
+        return [&](auto promise) {
+            _state->pop(std::move(promise));
+        };
+    }
+
+    ///Count of items (ready and not ready)
+    std::size_t size() const {
+        return _state->size();
+    }
+
+    ///Determines whether the queue is empty
+    bool empty() const {
+        return size() == 0;
+    }
+
+    ///unblock first awaiting consumer with an exception
+    /**
+     * @param e exception
+     * @retval true success
+     * @retval false nobody is awaiting
+     */
+    bool unblock_pop(std::exception_ptr e) {
+        return _state->unblock_pop(e);
+    }
+
+protected:
+
+    struct item {
+        clock::time_point _tp;
+        std::uint64_t _seq;
+        T _value;
+        bool operator>(const item &other) const {
+            return _tp > other._tp || (_tp == other._tp && _seq > other._seq);
+        }
+    };
+
+    using ready_list = std::vector<std::pair<promise<T>, T> >;
+
+    class state: public std::enable_shared_from_this<state> {
+    public:
+        state(scheduler &sch):_sch(sch) {}
+
+        void push(T &&value, clock::time_point tp) {
+            ready_list ready;
+            //removed timer is dropped outside of the lock
+            scheduler::promise tm;
+            {
+                std::lock_guard _(_mx);
+                _items.push(item{tp, _seq++, std::move(value)});
+                if (_awaiters.empty()) return;
+                auto now = clock::now();
+                if (tp <= now) collect(now, ready);
+                tm = arm();
+            }
+            resolve(ready);
+        }
+
+        void pop(promise<T> &&p) {
+            ready_list ready;
+            scheduler::promise tm;
+            {
+                std::lock_guard _(_mx);
+                _awaiters.push_back(std::move(p));
+                collect(clock::now(), ready);
+                tm = arm();
+            }
+            resolve(ready);
+        }
+
+        std::size_t size() const {
+            std::lock_guard _(_mx);
+            return _items.size();
+        }
+
+        bool unblock_pop(std::exception_ptr e) {
+            promise<T> p;
+            scheduler::promise tm;
+            {
+                std::lock_guard _(_mx);
+                if (_awaiters.empty()) return false;
+                p = std::move(_awaiters.front());
+                _awaiters.pop_front();
+                tm = arm();
+            }
+            p.set_exception(e);
+            return true;
+        }
+
+        void close() {
+            scheduler::promise tm;
+            std::deque<promise<T> > awaiters;
+            {
+                std::lock_guard _(_mx);
+                tm = _sch.remove(_timer);
+                _armed = clock::time_point::max();
+                std::swap(awaiters, _awaiters);
+            }
+        }
+
+    protected:
+        scheduler &_sch;
+        mutable std::mutex _mx;
+        priority_queue<item, std::vector<item>, std::greater<item> > _items;
+        std::deque<promise<T> > _awaiters;
+        std::uint64_t _seq = 0;
+        scheduler::timer _timer;
+        //time for which the timer is scheduled
+        clock::time_point _armed = clock::time_point::max();
+
+        //under lock, moves ready items to awaiters
+        void collect(clock::time_point now, ready_list &ready) {
+            while (!_awaiters.empty() && !_items.empty() && _items.top()._tp <= now) {
+                item it = _items.pop_item();
+                ready.emplace_back(std::move(_awaiters.front()), std::move(it._value));
+                _awaiters.pop_front();
+            }
+        }
+
+        //under lock, schedules the timer to the earliest item if a consumer is waiting
+        //returns removed timer, which must be dropped outside of the lock
+        scheduler::promise arm() {
+            clock::time_point tp = (_awaiters.empty() || _items.empty())
+                    ?clock::time_point::max():_items.top()._tp;
+            if (tp == _armed) return {};
+            scheduler::promise tm = _sch.remove(_timer);
+            _armed = tp;
+            if (tp != clock::time_point::max()) {
+                _sch.schedule(_timer, make_promise<void>([me = this->shared_from_this()](future<void> &f){
+                    me->on_timer(f);
+                }), tp);
+            }
+            return tm;
+        }
+
+        void on_timer(future<void> &f) {
+            try {
+                f.value();
+            } catch (...) {
+                //canceled
+                return;
+            }
+            ready_list ready;
+            scheduler::promise tm;
+            {
+                std::lock_guard _(_mx);
+                //the timer is no longer scheduled
+                _armed = clock::time_point::max();
+                collect(clock::now(), ready);
+                tm = arm();
+            }
+            resolve(ready);
+        }
+
+        static void resolve(ready_list &ready) {
+            for (auto &[p, v]: ready) p(std::move(v));
+        }
+    };
+
+    std::shared_ptr<state> _state;
+};
+
+}
+
+#endif /* SRC_COCLASSES_DELAY_QUEUE_H_ */
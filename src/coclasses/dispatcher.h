@@ -8,6 +8,7 @@
 #include "exceptions.h"
 #include "future.h"
 #include "priority_queue.h"
+#include "resume_watchdog.h"
 
 
 #include <memory>
@@ -74,6 +75,18 @@ public:
         instance = std::make_shared<dispatcher>();
     }
 
+    ///Attach watchdog to dispatcher of current thread
+    /**
+     * The watchdog reports coroutines, which run too long in dispatcher's thread
+     * @param watchdog watchdog instance. It must outlive the thread
+     * @exception no_thread_dispatcher_is_initialized_exception you must explicitly call
+     *   dispatcher::init();
+     */
+    static void attach_watchdog(resume_watchdog &watchdog) {
+        if (instance == nullptr) throw no_thread_dispatcher_is_initialized_exception();
+        instance->_watchdog = watchdog.attach("dispatcher");
+    }
+
     ///awaits on an awaiter
     /**
      * Runs dispatcher until specified awaiter becomes signaled
@@ -231,6 +244,7 @@ protected:
                 if (!_cond.wait_until(lk, _timers.top()._tp, [&]{return !_queue.empty() || exit_flag;})) {
                     auto t = _timers.pop_item();
                     lk.unlock();
+                    resume_watchdog::scope _(_watchdog, nullptr);
                     t._coro();
                     lk.lock();
                     continue;
@@ -240,7 +254,7 @@ protected:
             auto h = _queue.front();
             _queue.pop();
             lk.unlock();
-            h.resume();
+            resume(h);
             lk.lock();
         }
     }
@@ -251,12 +265,17 @@ protected:
             auto h = _queue.front();
             _queue.pop();
             lk.unlock();
-            h.resume();
+            resume(h);
             lk.lock();
         }
     }
 
 
+    void resume(std::coroutine_handle<> h) {
+        resume_watchdog::scope _(_watchdog, h.address());
+        h.resume();
+    }
+
     void quit(bool &exit_flag) {
         std::unique_lock lk(_mx);
         exit_flag = true;
@@ -282,6 +301,7 @@ protected:
     std::condition_variable _cond;
     std::queue<std::coroutine_handle<> > _queue;
     priority_queue<timer, std::vector<timer>, std::greater<timer> > _timers;
+    resume_watchdog::registration _watchdog;
 
     static dispatcher * & current_pool() {
         static thread_local dispatcher *c = nullptr;
@@ -0,0 +1,233 @@
+/**
+ * @file fork_join.h
+ *
+ * Fork-join with continuation stealing
+ */
+#pragma once
+#ifndef SRC_COCLASSES_FORK_JOIN_H_
+#define SRC_COCLASSES_FORK_JOIN_H_
+
+#include "future.h"
+#include "poolalloc.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <cassert>
+#include <coroutine>
+#include <mutex>
+
+namespace cocls {
+
+///Scope of forked children
+/**
+ * The coroutine forks children through co_await scope.fork(child). The child is
+ * executed immediately in the current thread, while continuation of the parent is pushed
+ * to the deque of the current worker of the thread pool. Idle workers can steal the
+ * continuation and continue the parent in parallel. If nobody steals it, the worker
+ * takes it back after the child finishes, so the code runs as serial recursion with
+ * minimal overhead.
+ *
+ * The function co_await scope.join() waits until all forked children finish. If any
+ * child failed, the first exception is rethrown. The scope can be reused after join.
+ *
+ * @code
+ * cocls::async<void> quicksort(int *beg, int *end) {
+ *      if (end - beg < 1000) {std::sort(beg, end); co_return;}
+ *      int *mid = partition(beg, end);
+ *      cocls::fork_scope scope;
+ *      co_await scope.fork(quicksort(beg, mid));
+ *      co_await quicksort(mid, end);
+ *      co_await scope.join();
+ * }
+ *
+ * cocls::future<void> f = pool.run(quicksort(v.data(), v.data()+v.size()));
+ * @endcode
+ *
+ * A child can be a coroutine async<void> or a function returning void. When a coroutine
+ * child suspends, the parent continues the same way as if the child finished.
+ *
+ * @note Stealing is possible only when the parent runs in a worker of a thread pool.
+ * Otherwise the children are executed serially.
+ *
+ * @note The scope must be joined before it is destroyed.
+ */
+class fork_scope {
+public:
+
+    fork_scope() = default;
+    fork_scope(const fork_scope &) = delete;
+    fork_scope &operator=(const fork_scope &) = delete;
+    ~fork_scope() {
+        assert("Destroy of fork_scope with pending children, missing join()" && _pending.load() == 1);
+    }
+
+    template<typename Child> class fork_awaiter;
+    class join_awaiter;
+
+    ///Fork a child
+    /**
+     * @param child coroutine async<void> or function returning void
+     * @return awaiter, which must be co_awaited
+     */
+    template<typename Child>
+    fork_awaiter<std::decay_t<Child> > fork(Child &&child) {
+        return fork_awaiter<std::decay_t<Child> >(*this, std::forward<Child>(child));
+    }
+
+    ///Wait for all children
+    /**
+     * @return awaiter, which must be co_awaited. It rethrows the first exception of
+     * children
+     */
+    join_awaiter join() {
+        return join_awaiter(*this);
+    }
+
+    template<typename Child>
+    class fork_awaiter {
+    public:
+        fork_awaiter(fork_scope &scope, Child &&child):_scope(scope), _child(std::move(child)) {}
+        fork_awaiter(const fork_awaiter &) = delete;
+        fork_awaiter &operator=(const fork_awaiter &) = delete;
+
+        static constexpr bool await_ready() noexcept {return false;}
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) {
+            //the awaiter can be destroyed by a thief, take everything now
+            fork_scope &scope = _scope;
+            Child child(std::move(_child));
+            scope._pending.fetch_add(1, std::memory_order_relaxed);
+            bool pushed = thread_pool::push_local([h]{h.resume();}, h.address());
+            std::coroutine_handle<> w = scope.run_child(child);
+            if (!pushed || thread_pool::take_local(h.address())) return h;
+            //parent was stolen, it can wait in join() for this child
+            if (w) return w;
+            return std::noop_coroutine();
+        }
+
+        static constexpr void await_resume() noexcept {}
+
+    protected:
+        fork_scope &_scope;
+        Child _child;
+    };
+
+    class join_awaiter {
+    public:
+        join_awaiter(fork_scope &scope):_scope(scope) {}
+        join_awaiter(const join_awaiter &) = delete;
+        join_awaiter &operator=(const join_awaiter &) = delete;
+
+        bool await_ready() const noexcept {
+            return _scope._pending.load(std::memory_order_acquire) == 1;
+        }
+
+        bool await_suspend(std::coroutine_handle<> h) noexcept {
+            _scope._waiting = h;
+            //remove own reference, the last child resumes the coroutine
+            return _scope._pending.fetch_sub(1, std::memory_order_acq_rel) != 1;
+        }
+
+        void await_resume() {
+            _scope._pending.store(1, std::memory_order_relaxed);
+            _scope._waiting = {};
+            std::exception_ptr e;
+            {
+                std::lock_guard _(_scope._mx);
+                e = std::exchange(_scope._exception, nullptr);
+            }
+            if (e) std::rethrow_exception(e);
+        }
+
+    protected:
+        fork_scope &_scope;
+    };
+
+protected:
+
+    //count of children + 1 (reference of the join)
+    std::atomic<unsigned int> _pending = 1;
+    std::coroutine_handle<> _waiting;
+    std::mutex _mx;
+    std::exception_ptr _exception;
+
+    //coroutine child which suspended, deletes itself when the child finishes
+    struct child_op: public abstract_awaiter {
+        child_op(fork_scope &scope):_scope(scope) {}
+
+        fork_scope &_scope;
+        future<void> _f;
+
+        virtual void resume() noexcept override {
+            fork_scope &scope = _scope;
+            std::exception_ptr e = get_exception(_f);
+            delete this;
+            auto w = scope.child_done(e);
+            if (w) w.resume();
+        }
+
+        void *operator new(std::size_t sz) {
+            return coro_promise_base::default_new(sz);
+        }
+        void operator delete(void *ptr, std::size_t sz) {
+            coro_promise_base::default_delete(ptr, sz);
+        }
+    };
+
+    template<typename P>
+    class async_ext: public async<void, P> {
+    public:
+        void start(future<void> &f) {
+            auto h = std::exchange(this->_h, {});
+            auto &p = h.promise();
+            p.initialize_policy();
+            p._future = f.get_promise().claim();
+            //resume directly, policy could defer the child
+            h.resume();
+        }
+    };
+
+    static std::exception_ptr get_exception(future<void> &f) {
+        try {
+            f.value();
+            return nullptr;
+        } catch (...) {
+            return std::current_exception();
+        }
+    }
+
+    //returns coroutine waiting in join, if this was the last child
+    std::coroutine_handle<> child_done(std::exception_ptr e) {
+        if (e) {
+            std::lock_guard _(_mx);
+            if (!_exception) _exception = e;
+        }
+        if (_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) return _waiting;
+        return {};
+    }
+
+    template<typename P>
+    std::coroutine_handle<> run_child(async<void, P> &child) {
+        auto op = new child_op(*this);
+        static_cast<async_ext<P> &>(child).start(op->_f);
+        if (op->_f.subscribe(op)) return {};
+        std::exception_ptr e = get_exception(op->_f);
+        delete op;
+        return child_done(e);
+    }
+
+    template<typename Fn>
+    std::coroutine_handle<> run_child(Fn &fn) {
+        std::exception_ptr e;
+        try {
+            fn();
+        } catch (...) {
+            e = std::current_exception();
+        }
+        return child_done(e);
+    }
+};
+
+}
+
+#endif /* SRC_COCLASSES_FORK_JOIN_H_ */
@@ -13,6 +13,7 @@
 
 #include "poolalloc.h"
 #include "coro_policy_holder.h"
+#include "trace.h"
 
 #include <assert.h>
 #include <atomic>
@@ -408,6 +409,17 @@ public:
         return subscribe_awaiter(awt);
     }
 
+    ///unsubscribes awaiter registered by subscribe()
+    /**
+     * @param awt awaiter to unsubscribe
+     * @retval true awaiter unsubscribed, it will not be signaled
+     * @retval false future is already resolved, the awaiter is being signaled, or the
+     * awaiter is not subscribed
+     */
+    bool unsubscribe(abstract_awaiter *awt) {
+        return awt->unsubscribe_check_ready(_awaiter, empty_awaiter::disabled);
+    }
+
 
     ///has_value() awaiter return by function has_value()
     class [[nodiscard]] has_value_awt: public co_awaiter_policy_base<future<T>> {
@@ -514,11 +526,15 @@ protected:
     }
 
     void resolve() {
+        COCLS_TRACE1(future_resolve, this);
         awaiter::resume_chain_set_ready(_awaiter, empty_awaiter::disabled, nullptr);
     }
     std::coroutine_handle<> resolve_resume() {
+        COCLS_TRACE1(future_resolve, this);
         auto n = std::noop_coroutine();
         awaiter *x = _awaiter.exchange(&empty_awaiter::disabled, std::memory_order_release);
+        //chain is held by unsubscribe(), which resumes it
+        if (x == awaiter::lock_state()) x = nullptr;
         while (x != nullptr) {
             auto a = x;
             x = x->_next;
@@ -1242,6 +1258,46 @@ protected:
     bool _constructed;
 };
 
+///Future, which moves its value out when it is retrieved
+/**
+ * Standard future returns reference to the value, so the value of move-only type must be
+ * moved out explicitly. This future returns the value itself, so the code
+ * @code
+ * auto x = co_await fut;
+ * @endcode
+ * works for move-only types (leases, permits, etc). The value can be retrieved only once.
+ *
+ * @tparam T type of value
+ */
+template<typename T>
+class [[nodiscard]] unique_future: public future<T> {
+public:
+
+    ///Awaiter, moves the value out
+    class co_awaiter: public ::cocls::co_awaiter<future<T> > {
+    public:
+        using ::cocls::co_awaiter<future<T> >::co_awaiter;
+        T await_resume() {
+            return std::move(::cocls::co_awaiter<future<T> >::await_resume());
+        }
+        T wait() {
+            this->sync();
+            return await_resume();
+        }
+    };
+
+    using future<T>::future;
+
+    co_awaiter operator co_await() {
+        return co_awaiter(*this);
+    }
+
+    ///Wait synchronously, returns the value
+    T wait() {
+        return std::move(future<T>::wait());
+    }
+};
+
 namespace _details {
 
 template<typename T>
@@ -1257,6 +1313,12 @@ struct IsFuture<future_with_context<T, X> > {
     using Type = T;
 };
 
+template<typename T>
+struct IsFuture<unique_future<T> > {
+    static constexpr bool value = true;
+    using Type = T;
+};
+
 template<typename T>
 struct IsFuture<shared_future<T> > {
     static constexpr bool value = true;
@@ -0,0 +1,269 @@
+/**
+ * @file hedge.h
+ *
+ * Hedged requests
+ */
+#pragma once
+#ifndef SRC_COCLASSES_HEDGE_H_
+#define SRC_COCLASSES_HEDGE_H_
+
+#include "future.h"
+#include "scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <vector>
+
+namespace cocls {
+
+///Tracks latency of operations and calculates delay of the hedged request
+/**
+ * Keeps a window of recent latencies and calculates specified percentile. The percentile
+ * is recalculated after every 1/16 of the window, so reading the delay is cheap.
+ *
+ * @code
+ * cocls::hedge_delay delay(0.95);
+ * auto r = co_await cocls::hedge([&]{return replica.call();}, delay, 2, sch);
+ * @endcode
+ */
+class hedge_delay {
+public:
+
+    using duration = std::chrono::nanoseconds;
+
+    ///Construct the tracker
+    /**
+     * @param percentile percentile (0..1) used as the delay
+     * @param window count of recent samples
+     * @param initial delay used until there is enough samples
+     */
+    explicit hedge_delay(double percentile = 0.95, std::size_t window = 1000,
+                         duration initial = std::chrono::milliseconds(10))
+        :_percentile(std::clamp(percentile, 0.0, 1.0))
+        ,_window(std::max<std::size_t>(window, 16))
+        ,_delay(initial) {}
+
+    ///Record latency of an operation
+    template<typename A, typename B>
+    void record(std::chrono::duration<A,B> latency) {
+        std::lock_guard _(_mx);
+        auto v = std::chrono::duration_cast<duration>(latency);
+        if (_samples.size() < _window) _samples.push_back(v);
+        else _samples[_pos] = v;
+        _pos = (_pos + 1) % _window;
+        if (++_count % (_window / 16) == 0) recalc();
+    }
+
+    ///Retrieve current delay
+    duration get() const {
+        std::lock_guard _(_mx);
+        return _delay;
+    }
+
+protected:
+    double _percentile;
+    std::size_t _window;
+    mutable std::mutex _mx;
+    std::vector<duration> _samples;
+    std::size_t _pos = 0;
+    std::size_t _count = 0;
+    duration _delay;
+
+    void recalc() {
+        std::vector<duration> tmp(_samples);
+        auto n = static_cast<std::size_t>(_percentile * static_cast<double>(tmp.size() - 1));
+        std::nth_element(tmp.begin(), tmp.begin() + n, tmp.end());
+        _delay = tmp[n];
+    }
+};
+
+namespace _details {
+
+template<typename T, typename Fn>
+class hedge_state: public std::enable_shared_from_this<hedge_state<T, Fn> > {
+public:
+
+    hedge_state(promise<T> &&p, Fn &&fn, scheduler &sch, std::chrono::nanoseconds delay,
+                unsigned int max_attempts, hedge_delay *tracker)
+        :_promise(std::move(p))
+        ,_fn(std::forward<Fn>(fn))
+        ,_sch(sch)
+        ,_delay(delay)
+        ,_max(std::max(max_attempts, 1U))
+        ,_tracker(tracker) {}
+
+    void start() {
+        launch();
+        std::lock_guard _(_mx);
+        arm_timer();
+    }
+
+protected:
+
+    struct attempt: public abstract_awaiter {
+        future<T> _f;
+        std::chrono::steady_clock::time_point _start;
+        //keeps state alive while the attempt is running
+        std::shared_ptr<hedge_state> _keep;
+
+        virtual void resume() noexcept override {
+            auto st = std::move(_keep);
+            st->on_result(*this);
+        }
+    };
+
+    promise<T> _promise;
+    std::decay_t<Fn> _fn;
+    scheduler &_sch;
+    std::chrono::nanoseconds _delay;
+    unsigned int _max;
+    hedge_delay *_tracker;
+    std::mutex _mx;
+    std::deque<attempt> _attempts;
+    std::stop_source _stop;
+    scheduler::timer _timer;
+    unsigned int _running = 0;
+    bool _done = false;
+
+    void launch() {
+        attempt *a;
+        {
+            std::lock_guard _(_mx);
+            if (_done || _attempts.size() >= _max) return;
+            a = &_attempts.emplace_back();
+            a->_keep = this->shared_from_this();
+            a->_start = std::chrono::steady_clock::now();
+            ++_running;
+        }
+        a->_f << [&]{
+            if constexpr(std::is_invocable_v<Fn, std::stop_token>) return _fn(_stop.get_token());
+            else return _fn();
+        };
+        if (!a->_f.subscribe(a)) a->resume();
+    }
+
+    //under lock
+    void arm_timer() {
+        if (_done || _attempts.size() >= _max) return;
+        _sch.schedule(_timer, make_promise<void>([me = this->shared_from_this()](future<void> &f){
+            me->on_timer(f);
+        }), std::chrono::system_clock::now() + _delay);
+    }
+
+    void on_timer(future<void> &f) {
+        try {
+            f.value();
+        } catch (...) {
+            //canceled
+            return;
+        }
+        launch();
+        std::lock_guard _(_mx);
+        arm_timer();
+    }
+
+    void on_result(attempt &a) {
+        std::exception_ptr e;
+        try {
+            a._f.value();
+        } catch (...) {
+            e = std::current_exception();
+        }
+        std::unique_lock lk(_mx);
+        --_running;
+        if (_done) return;
+        if (!e) {
+            _done = true;
+            lk.unlock();
+            finish(a);
+        } else if (_attempts.size() < _max) {
+            //failed attempt, try next replica immediately
+            lk.unlock();
+            launch();
+        } else if (_running == 0) {
+            _done = true;
+            lk.unlock();
+            _sch.cancel(_timer);
+            _promise(e);
+        }
+    }
+
+    void finish(attempt &a) {
+        _sch.cancel(_timer);
+        _stop.request_stop();
+        if (_tracker) _tracker->record(std::chrono::steady_clock::now() - a._start);
+        if constexpr(std::is_void_v<T>) _promise();
+        else _promise(std::move(a._f.value()));
+    }
+};
+
+template<typename Fn>
+auto hedge_call(Fn &fn) {
+    if constexpr(std::is_invocable_v<Fn, std::stop_token>) return fn(std::stop_token());
+    else return fn();
+}
+
+template<typename Fn>
+using hedge_result_t = typename IsFuture<std::decay_t<decltype(hedge_call(std::declval<Fn &>()))> >::Type;
+
+template<typename Fn>
+future<hedge_result_t<Fn> > hedge_start(Fn &&fn, std::chrono::nanoseconds delay,
+                                        unsigned int max_attempts, scheduler &sch, hedge_delay *tracker) {
+    using T = hedge_result_t<Fn>;
+    return [&](auto promise) {
+        auto st = std::make_shared<hedge_state<T, Fn> >(std::move(promise), std::forward<Fn>(fn),
+                sch, delay, max_attempts, tracker);
+        st->start();
+    };
+}
+
+}
+
+///Run hedged request
+/**
+ * Starts the operation. If the operation doesn't complete within the delay, the
+ * operation is started again (for example on other replica) while the first attempt
+ * is still running. This repeats until max_attempts is reached. The first successful
+ * result is returned. Failed attempt starts the next attempt immediately. If all attempts
+ * fail, the last exception is returned.
+ *
+ * Other attempts are ignored when the result is available. If the function accepts
+ * std::stop_token, the stop is requested on the token, so attempts can be canceled.
+ *
+ * @param fn function which starts the operation and returns future<T>. The function is
+ * called for every attempt. It can accept std::stop_token
+ * @param delay delay before next attempt is started
+ * @param max_attempts maximum count of attempts
+ * @param sch scheduler used for delays
+ * @return future with the result
+ */
+template<typename Fn, typename A, typename B>
+auto hedge(Fn &&fn, std::chrono::duration<A,B> delay, unsigned int max_attempts, scheduler &sch)
+    -> future<_details::hedge_result_t<Fn> > {
+    return _details::hedge_start(std::forward<Fn>(fn),
+            std::chrono::duration_cast<std::chrono::nanoseconds>(delay), max_attempts, sch, nullptr);
+}
+
+///Run hedged request, delay is taken from observed latencies
+/**
+ * @param fn function which starts the operation and returns future<T>
+ * @param delay tracker of latencies. Latency of successful requests are recorded
+ * @param max_attempts maximum count of attempts
+ * @param sch scheduler used for delays
+ * @return future with the result
+ *
+ * @see hedge_delay
+ */
+template<typename Fn>
+auto hedge(Fn &&fn, hedge_delay &delay, unsigned int max_attempts, scheduler &sch)
+    -> future<_details::hedge_result_t<Fn> > {
+    return _details::hedge_start(std::forward<Fn>(fn), delay.get(), max_attempts, sch, &delay);
+}
+
+}
+
+#endif /* SRC_COCLASSES_HEDGE_H_ */
@@ -0,0 +1,450 @@
+/**
+ * @file incremental.h
+ *
+ * Incremental computation graph
+ */
+#pragma once
+#ifndef SRC_COCLASSES_INCREMENTAL_H_
+#define SRC_COCLASSES_INCREMENTAL_H_
+
+#include "future.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <concepts>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+namespace cocls {
+
+class incremental_context;
+template<typename T> class incremental_input;
+template<typename T> class incremental_node;
+
+///Incremental computation graph
+/**
+ * The graph consists of inputs (incremental_input) and computed nodes
+ * (incremental_node). A computed node is a lazy asynchronous computation. It is
+ * computed when it is awaited for the first time and the result is memoized. During the
+ * computation, the node records which inputs and nodes it reads.
+ *
+ * Changing an input marks all its dependents dirty, nothing is computed at this point.
+ * When a dirty node is awaited, its previous dependencies are brought up to date first.
+ * Dirty dependencies are updated in parallel on the thread pool. If none of them changed,
+ * the node is not computed again. If the computed value is equal to the previous value,
+ * dependents of the node are not recomputed (early cutoff).
+ *
+ * @code
+ * cocls::incremental_graph g(pool);
+ * cocls::incremental_input<int> price(g, 100);
+ * cocls::incremental_input<double> vat(g, 0.21);
+ * cocls::incremental_node<double> total(g, [&](cocls::incremental_context &ctx) {
+ *      return ctx.get(price) * (1.0 + ctx.get(vat));
+ * });
+ *
+ * double t = co_await total.get();
+ * vat.set(0.15);
+ * t = co_await total.get();    //recomputed
+ * @endcode
+ *
+ * @note All nodes must be destroyed before the graph. The graph of dependencies must be
+ * acyclic
+ */
+class incremental_graph {
+public:
+
+    ///Construct the graph
+    /**
+     * @param pool thread pool used for computations
+     */
+    explicit incremental_graph(thread_pool &pool):_pool(pool) {}
+    incremental_graph(const incremental_graph &) = delete;
+    incremental_graph &operator=(const incremental_graph &) = delete;
+
+    ///Returns count of computations performed by all nodes
+    std::size_t computations() const {
+        std::lock_guard _(_mx);
+        return _computations;
+    }
+
+protected:
+
+    enum class state {
+        ///value is valid
+        clean,
+        ///value can be invalid, must be verified
+        dirty,
+        ///node is being updated
+        updating
+    };
+
+    class node_base {
+    public:
+        node_base(incremental_graph &g, state st):_g(g), _state(st) {}
+        node_base(const node_base &) = delete;
+        node_base &operator=(const node_base &) = delete;
+        virtual ~node_base() = default;
+
+    protected:
+
+        struct dependency {
+            node_base *_node;
+            //version of the dependency when it was read
+            std::uint64_t _seen;
+        };
+
+        incremental_graph &_g;
+        state _state;
+        //set when the node is invalidated while it is being updated
+        bool _stale = false;
+        //version of the value, changes only when the value changes
+        std::uint64_t _changed = 0;
+        std::vector<node_base *> _dependents;
+        std::vector<dependency> _deps;
+        //signals the last update, resolved when the node is clean
+        shared_future<void> _update;
+
+        //starts update in the thread pool
+        virtual void start_update(promise<void> &&p) = 0;
+
+        //brings the node up to date, returns future resolved when the node is clean
+        shared_future<void> refresh() {
+            promise<void> p;
+            {
+                std::lock_guard _(_g._mx);
+                if (_state != state::dirty) return _update;
+                _state = state::updating;
+                _update = shared_future<void>([&](auto prom){p = std::move(prom);});
+            }
+            shared_future<void> res = _update;
+            start_update(std::move(p));
+            return res;
+        }
+
+        //under lock
+        void invalidate_dependents() {
+            for (node_base *d: _dependents) {
+                if (d->_state == state::clean) {
+                    d->_state = state::dirty;
+                    d->invalidate_dependents();
+                } else if (d->_state == state::updating && !d->_stale) {
+                    d->_stale = true;
+                    d->invalidate_dependents();
+                }
+            }
+        }
+
+        //under lock
+        void link(node_base *dep) {
+            auto iter = std::find(dep->_dependents.begin(), dep->_dependents.end(), this);
+            if (iter == dep->_dependents.end()) dep->_dependents.push_back(this);
+        }
+
+        //under lock
+        void unlink(node_base *dep) {
+            auto iter = std::find(dep->_dependents.begin(), dep->_dependents.end(), this);
+            if (iter != dep->_dependents.end()) dep->_dependents.erase(iter);
+        }
+
+        //under lock
+        void detach() {
+            for (const auto &d: _deps) unlink(d._node);
+            for (node_base *d: _dependents) {
+                auto &v = d->_deps;
+                v.erase(std::remove_if(v.begin(), v.end(), [&](const dependency &x){
+                    return x._node == this;
+                }), v.end());
+            }
+        }
+
+        friend class incremental_context;
+        friend class incremental_graph;
+        template<typename> friend class incremental_node;
+    };
+
+    template<typename T>
+    static bool same_value(const std::optional<T> &a, const std::optional<T> &b) {
+        if constexpr(std::equality_comparable<T>) {
+            return a.has_value() && b.has_value() && *a == *b;
+        } else {
+            return false;
+        }
+    }
+
+    thread_pool &_pool;
+    mutable std::mutex _mx;
+    std::uint64_t _clock = 0;
+    std::size_t _computations = 0;
+
+    template<typename> friend class incremental_input;
+    template<typename> friend class incremental_node;
+    friend class incremental_context;
+};
+
+///Context of computation of a node, records dependencies
+class incremental_context {
+public:
+
+    ///Read input, record dependency
+    template<typename T>
+    T get(const incremental_input<T> &input) {
+        std::lock_guard _(_owner._g._mx);
+        record(const_cast<incremental_input<T> &>(input));
+        return input._value;
+    }
+
+    ///Await other node, record dependency
+    /**
+     * @param node node to await
+     * @return future with value of the node
+     */
+    template<typename T>
+    future<T> get(incremental_node<T> &node) {
+        std::size_t idx;
+        {
+            std::lock_guard _(_owner._g._mx);
+            idx = record(node);
+        }
+        return node.get(this, idx);
+    }
+
+protected:
+
+    using dependency = incremental_graph::node_base::dependency;
+
+    incremental_context(incremental_graph::node_base &owner):_owner(owner) {}
+
+    incremental_graph::node_base &_owner;
+    std::vector<dependency> _deps;
+
+    //under lock, the same lock under which the value is read. Linked before the value
+    //is read, so changes made after reading invalidate the owner. Returns index of
+    //the dependency
+    std::size_t record(incremental_graph::node_base &n) {
+        auto iter = std::find_if(_deps.begin(), _deps.end(), [&](const dependency &d){
+            return d._node == &n;
+        });
+        if (iter != _deps.end()) return iter - _deps.begin();
+        _deps.push_back({&n, n._changed});
+        _owner.link(&n);
+        return _deps.size() - 1;
+    }
+
+    //under lock, value of the dependency has been read now
+    void read(std::size_t idx) {
+        _deps[idx]._seen = _deps[idx]._node->_changed;
+    }
+
+    //under lock, replaces dependencies of the owner
+    void commit() {
+        for (const auto &d: _owner._deps) {
+            auto iter = std::find_if(_deps.begin(), _deps.end(), [&](const dependency &x){
+                return x._node == d._node;
+            });
+            if (iter == _deps.end()) _owner.unlink(d._node);
+        }
+        _owner._deps = std::move(_deps);
+    }
+
+    template<typename> friend class incremental_node;
+};
+
+///Input of the incremental graph
+/**
+ * @tparam T type of value
+ */
+template<typename T>
+class incremental_input: public incremental_graph::node_base {
+public:
+
+    ///Construct the input
+    /**
+     * @param g graph
+     * @param value initial value
+     */
+    incremental_input(incremental_graph &g, T value)
+        :node_base(g, incremental_graph::state::clean), _value(std::move(value)) {
+        _update = shared_future<void>::set_value();
+    }
+
+    ~incremental_input() {
+        std::lock_guard _(_g._mx);
+        detach();
+    }
+
+    ///Retrieve current value
+    T get() const {
+        std::lock_guard _(_g._mx);
+        return _value;
+    }
+
+    ///Change the value
+    /**
+     * Marks all dependents dirty. If the new value is equal to current value, nothing
+     * happens
+     */
+    void set(T value) {
+        std::lock_guard _(_g._mx);
+        if constexpr(std::equality_comparable<T>) {
+            if (_value == value) return;
+        }
+        _value = std::move(value);
+        _changed = ++_g._clock;
+        invalidate_dependents();
+    }
+
+protected:
+    T _value;
+
+    virtual void start_update(promise<void> &&) override {}
+
+    friend class incremental_context;
+};
+
+///Computed node of the incremental graph
+/**
+ * @tparam T type of value
+ */
+template<typename T>
+class incremental_node: public incremental_graph::node_base {
+public:
+
+    ///Function which computes the value
+    /** The function receives context, which it uses to read inputs and other nodes. It
+     * can return T or future<T>, so it can be a coroutine async<T>
+     */
+    using function = std::function<future<T>(incremental_context &)>;
+
+    ///Construct the node
+    /**
+     * @param g graph
+     * @param fn function which computes the value. The function is not called now
+     */
+    template<typename Fn>
+    incremental_node(incremental_graph &g, Fn &&fn)
+        :node_base(g, incremental_graph::state::dirty), _fn(wrap(std::forward<Fn>(fn))) {}
+
+    ~incremental_node() {
+        std::lock_guard _(_g._mx);
+        detach();
+    }
+
+    ///Retrieve value, update the node if needed
+    /**
+     * @return future with the value. If the node is clean, the future is already resolved.
+     * If the computation failed, the future contains the exception
+     */
+    future<T> get() {
+        shared_future<void> f = refresh();
+        if (f.ready()) return read();
+        return get_async(std::move(f));
+    }
+
+    ///Determines whether the node must be updated before its value can be read
+    bool dirty() const {
+        std::lock_guard _(_g._mx);
+        return _state != incremental_graph::state::clean;
+    }
+
+protected:
+
+    function _fn;
+    std::optional<T> _value;
+    std::exception_ptr _exception;
+
+    template<typename Fn>
+    static function wrap(Fn &&fn) {
+        using Ret = std::invoke_result_t<Fn &, incremental_context &>;
+        if constexpr(std::is_convertible_v<Ret, T>) {
+            return [fn = std::forward<Fn>(fn)](incremental_context &ctx) mutable -> future<T> {
+                return future<T>::set_value(fn(ctx));
+            };
+        } else {
+            return [fn = std::forward<Fn>(fn)](incremental_context &ctx) mutable -> future<T> {
+                return fn(ctx);
+            };
+        }
+    }
+
+    //retrieve value for a computation of other node, which records version of the value
+    future<T> get(incremental_context *ctx, std::size_t idx) {
+        shared_future<void> f = refresh();
+        if (f.ready()) return read(ctx, idx);
+        return get_async(std::move(f), ctx, idx);
+    }
+
+    future<T> read(incremental_context *ctx = nullptr, std::size_t idx = 0) {
+        std::lock_guard _(_g._mx);
+        if (ctx) ctx->read(idx);
+        if (_exception) return future<T>::set_exception(_exception);
+        return future<T>::set_value(*_value);
+    }
+
+    async<T> get_async(shared_future<void> f, incremental_context *ctx = nullptr, std::size_t idx = 0) {
+        co_await f;
+        std::lock_guard _(_g._mx);
+        if (ctx) ctx->read(idx);
+        if (_exception) std::rethrow_exception(_exception);
+        co_return *_value;
+    }
+
+    virtual void start_update(promise<void> &&p) override {
+        update(std::move(p)).detach();
+    }
+
+    async<void> update(promise<void> p) {
+        co_await _g._pool;
+        std::vector<dependency> deps;
+        bool changed;
+        {
+            std::lock_guard _(_g._mx);
+            deps = _deps;
+            changed = !_value.has_value() && !_exception;
+        }
+        if (!changed) {
+            //start update of all dependencies first, so they run in parallel
+            std::vector<shared_future<void> > fs;
+            fs.reserve(deps.size());
+            for (const auto &d: deps) fs.push_back(d._node->refresh());
+            for (auto &f: fs) co_await f;
+            std::lock_guard _(_g._mx);
+            changed = std::any_of(deps.begin(), deps.end(), [](const dependency &d){
+                return d._node->_changed != d._seen;
+            });
+        }
+        if (changed) {
+            incremental_context ctx(*this);
+            std::optional<T> v;
+            std::exception_ptr e;
+            try {
+                v.emplace(co_await _fn(ctx));
+            } catch (...) {
+                e = std::current_exception();
+            }
+            std::lock_guard _(_g._mx);
+            ++_g._computations;
+            ctx.commit();
+            if (e || _exception || !incremental_graph::same_value(v, _value)) {
+                _changed = ++_g._clock;
+                _value = std::move(v);
+                _exception = e;
+            }
+        }
+        {
+            std::lock_guard _(_g._mx);
+            _state = _stale?incremental_graph::state::dirty:incremental_graph::state::clean;
+            _stale = false;
+        }
+        p();
+    }
+
+    friend class incremental_context;
+};
+
+}
+
+#endif /* SRC_COCLASSES_INCREMENTAL_H_ */
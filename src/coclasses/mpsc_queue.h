@@ -0,0 +1,108 @@
+/**
+ * @file mpsc_queue.h
+ *
+ * Lock-free intrusive queue of awaiters (multiple producers, single consumer)
+ */
+#pragma once
+#ifndef SRC_COCLASSES_MPSC_QUEUE_H_
+#define SRC_COCLASSES_MPSC_QUEUE_H_
+
+#include "awaiter.h"
+
+#include <atomic>
+
+namespace cocls {
+
+///Lock-free intrusive queue of awaiters with activation
+/**
+ * Producers push awaiters using single CAS operation. The queue has two states, idle
+ * and active. The first push to an idle queue makes the queue active and push()
+ * returns true - then the caller is responsible to activate the consumer. Other pushes
+ * return false. There is always at most one active consumer.
+ *
+ * The consumer pops items in FIFO order. When the queue is empty, the consumer
+ * calls try_idle(), which switches queue to idle state. If new items arrived, the function
+ * fails and the consumer must continue in processing.
+ *
+ * Items are chained through abstract_awaiter::_next, so no allocation is needed.
+ * Implementation uses the same principle as cocls::mutex. Producers build a LIFO stack,
+ * the consumer takes whole stack at once and reverses it.
+ */
+class mpsc_queue {
+public:
+
+    mpsc_queue() = default;
+    ///Construct queue
+    /**
+     * @param active set true to construct queue in active state. This is useful, when the
+     * consumer is running when the queue is created
+     */
+    explicit mpsc_queue(bool active):_requests(active?doorman():nullptr) {}
+    mpsc_queue(const mpsc_queue &) = delete;
+    mpsc_queue &operator=(const mpsc_queue &) = delete;
+
+    ///push item to the queue
+    /**
+     * @param item item to push
+     * @retval true queue was idle and it is active now, caller must activate the consumer
+     * @retval false queue is already active
+     */
+    bool push(abstract_awaiter *item) {
+        item->_next = nullptr;
+        item->subscribe(_requests);
+        return item->_next == nullptr;
+    }
+
+    ///pop item from the queue (consumer only)
+    /**
+     * @return next item or nullptr if there is no item. The queue stays active
+     */
+    abstract_awaiter *pop() {
+        if (!_queue) {
+            abstract_awaiter *req = _requests.exchange(doorman(), std::memory_order_acquire);
+            while (req && req != doorman()) {
+                auto x = req;
+                req = req->_next;
+                x->_next = _queue;
+                _queue = x;
+            }
+            if (!_queue) return nullptr;
+        }
+        abstract_awaiter *x = _queue;
+        _queue = x->_next;
+        x->_next = nullptr;
+        return x;
+    }
+
+    ///try to switch queue to idle state (consumer only)
+    /**
+     * @retval true queue is idle now, consumer must stop processing.
+     * @retval false queue is not empty, continue processing
+     */
+    bool try_idle() {
+        if (_queue) return false;
+        abstract_awaiter *x = doorman();
+        return _requests.compare_exchange_strong(x, nullptr, std::memory_order_release);
+    }
+
+    ///returns true, if queue is empty (consumer only)
+    bool empty() const {
+        if (_queue) return false;
+        auto x = _requests.load(std::memory_order_relaxed);
+        return x == nullptr || x == doorman();
+    }
+
+protected:
+    //requests (LIFO), nullptr - idle, doorman - active but empty
+    std::atomic<abstract_awaiter *> _requests = nullptr;
+    //queue owned by the consumer (FIFO)
+    abstract_awaiter *_queue = nullptr;
+
+    static constexpr abstract_awaiter *doorman() {
+        return &empty_awaiter::instance;
+    }
+};
+
+}
+
+#endif /* SRC_COCLASSES_MPSC_QUEUE_H_ */
@@ -8,6 +8,7 @@
 
 #include "awaiter.h"
 #include "common.h"
+#include "trace.h"
 #include <cassert>
 #include <coroutine>
 #include <memory>
@@ -170,6 +171,7 @@ protected:
         _queue = _queue->_next;
         //clear _next ptr to avoid leaking invalid pointer to next code
         first->_next = nullptr;
+        COCLS_TRACE2(mutex_handoff_unlock, this, first);
         //resume awaiter - it has ownership now
         first->resume();
         //now the _queue is also handled by the new owners
@@ -201,6 +203,7 @@ protected:
             return false;
         } else {
             //we are subscribed, so continue in suspend
+            COCLS_TRACE2(mutex_contended_lock, this, aw);
             return true;
         }
     }
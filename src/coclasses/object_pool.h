@@ -0,0 +1,350 @@
+/**
+ * @file object_pool.h
+ *
+ * Asynchronous pool of reusable objects
+ */
+#pragma once
+#ifndef SRC_COCLASSES_OBJECT_POOL_H_
+#define SRC_COCLASSES_OBJECT_POOL_H_
+
+#include "future.h"
+
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace cocls {
+
+///Pool of expensive objects (connections, parsers, etc), which are leased to coroutines
+/**
+ * Objects are created lazily by a factory up to specified maximum count. A coroutine
+ * obtains the object by co_await acquire(), which returns a lease. The lease is RAII object,
+ * the leased object is returned to the pool when the lease is destroyed.
+ *
+ * Free objects are tracked in a bitmap, so checkout and return are lock-free when
+ * objects are available. When the pool is exhausted, callers are put to a FIFO and
+ * each returned object is passed to the first waiter. While there are waiters, the
+ * fast path is disabled to keep the FIFO order.
+ *
+ * Every thread remembers the object it returned the last time and tries to lease
+ * the same object first. This helps to keep the object in the CPU cache of the thread.
+ *
+ * Objects idle for a long time can be destroyed by evict_idle(). They are created again
+ * when they are needed.
+ *
+ * @code
+ * cocls::object_pool<connection> pool(8, []{return std::make_unique<connection>(addr);});
+ *
+ * cocls::task<> query(cocls::object_pool<connection> &pool) {
+ *      auto conn = co_await pool.acquire();
+ *      conn->send(...);
+ * }  //connection is returned here
+ * @endcode
+ *
+ * @tparam T type of the object
+ *
+ * @note all leases must be returned before the pool is destroyed. Destruction of the
+ * pool cancels all waiters (await_canceled_exception)
+ */
+template<typename T>
+class object_pool {
+public:
+
+    using factory = std::function<std::unique_ptr<T>()>;
+    using clock = std::chrono::steady_clock;
+
+    ///Leased object. Returns object to the pool on destruction
+    class lease {
+    public:
+        lease() = default;
+        lease(lease &&other):_pool(std::exchange(other._pool, nullptr)), _idx(other._idx) {}
+        lease &operator=(lease &&other) {
+            if (this != &other) {
+                release();
+                _pool = std::exchange(other._pool, nullptr);
+                _idx = other._idx;
+            }
+            return *this;
+        }
+        ~lease() {
+            release();
+        }
+
+        T &operator*() const {return *get();}
+        T *operator->() const {return get();}
+        T *get() const {return _pool->_nodes[_idx]._obj.get();}
+
+        ///Returns true if the lease holds an object
+        explicit operator bool() const {return _pool != nullptr;}
+
+        ///Return object to the pool now
+        void release() {
+            if (_pool) std::exchange(_pool, nullptr)->put_back(_idx, true);
+        }
+
+        ///Destroy the object (for example broken connection)
+        /**
+         * The pool creates new object on next request
+         */
+        void discard() {
+            if (_pool) {
+                auto p = std::exchange(_pool, nullptr);
+                p->_nodes[_idx]._obj.reset();
+                p->put_back(_idx, false);
+            }
+        }
+
+    protected:
+        object_pool *_pool = nullptr;
+        std::size_t _idx = 0;
+
+        lease(object_pool *pool, std::size_t idx):_pool(pool), _idx(idx) {}
+        friend class object_pool;
+    };
+
+    ///Construct the pool
+    /**
+     * @param max_count maximum count of objects
+     * @param fn factory, which creates new object. Default factory uses
+     * std::make_unique<T>()
+     */
+    explicit object_pool(std::size_t max_count, factory fn = []{return std::make_unique<T>();})
+        :_max(max_count?max_count:1)
+        ,_words((_max + 63) / 64)
+        ,_factory(std::move(fn))
+        ,_nodes(std::make_unique<node[]>(_max))
+        ,_idle(std::make_unique<std::atomic<std::uint64_t>[]>(_words))
+        ,_empty(std::make_unique<std::atomic<std::uint64_t>[]>(_words))
+    {
+        for (std::size_t i = 0; i < _max; i++) {
+            _empty[i / 64].fetch_or(bit(i), std::memory_order_relaxed);
+        }
+    }
+
+    object_pool(const object_pool &) = delete;
+    object_pool &operator=(const object_pool &) = delete;
+
+    ~object_pool() {
+        std::deque<promise<lease> > q;
+        {
+            std::lock_guard _(_mx);
+            _closed = true;
+            std::swap(q, _queue);
+        }
+        for (auto &p: q) {
+            p(std::make_exception_ptr(await_canceled_exception()));
+        }
+    }
+
+    ///Acquire an object
+    /**
+     * @return future with the lease. If there is free object, the future is already
+     * resolved. If the factory throws an exception, the exception is passed to the future
+     */
+    unique_future<lease> acquire() {
+        return [&](auto promise) {
+            std::size_t idx = _waiting.load(std::memory_order_acquire) == 0?claim():npos;
+            if (idx != npos) deliver(std::move(promise), idx);
+            else enqueue(std::move(promise));
+        };
+    }
+
+    ///Acquire an object without waiting
+    /**
+     * @return lease or no value, if the pool is exhausted or there are waiters
+     */
+    std::optional<lease> try_acquire() {
+        if (_waiting.load(std::memory_order_acquire)) return {};
+        std::size_t idx = claim();
+        if (idx == npos) return {};
+        lease l(this, idx);
+        try {
+            create_if_needed(idx);
+        } catch (...) {
+            l._pool = nullptr;
+            put_back(idx, false);
+            throw;
+        }
+        return l;
+    }
+
+    ///Destroy objects which are idle for specified duration
+    /**
+     * @param max_idle maximum idle time
+     * @return count of destroyed objects
+     */
+    template<typename A, typename B>
+    std::size_t evict_idle(std::chrono::duration<A,B> max_idle) {
+        std::size_t cnt = 0;
+        auto now = clock::now();
+        for (std::size_t w = 0; w < _words; w++) {
+            std::uint64_t v = _idle[w].load(std::memory_order_relaxed);
+            while (v) {
+                std::uint64_t m = v & (~v + 1);
+                v &= ~m;
+                if (!(_idle[w].fetch_and(~m, std::memory_order_acquire) & m)) continue;
+                std::size_t idx = w * 64 + std::countr_zero(m);
+                node &n = _nodes[idx];
+                if (now - n._last >= max_idle) {
+                    n._obj.reset();
+                    ++cnt;
+                    put_back(idx, false);
+                } else {
+                    release_bit(_idle, idx);
+                }
+            }
+        }
+        return cnt;
+    }
+
+    ///Returns count of waiting callers
+    std::size_t waiting() const {
+        return _waiting.load(std::memory_order_relaxed);
+    }
+
+    ///Returns maximum count of objects
+    std::size_t capacity() const {
+        return _max;
+    }
+
+protected:
+
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    struct node {
+        std::unique_ptr<T> _obj;
+        clock::time_point _last;
+    };
+
+    struct hint {
+        const void *_pool = nullptr;
+        std::size_t _idx = 0;
+    };
+
+    using bitmap = std::unique_ptr<std::atomic<std::uint64_t>[]>;
+
+    std::size_t _max;
+    std::size_t _words;
+    factory _factory;
+    std::unique_ptr<node[]> _nodes;
+    //created objects ready to lease
+    bitmap _idle;
+    //free slots without object
+    bitmap _empty;
+    std::atomic<std::size_t> _waiting = 0;
+    std::mutex _mx;
+    std::deque<promise<lease> > _queue;
+    bool _closed = false;
+
+    static thread_local hint _hint;
+
+    static constexpr std::uint64_t bit(std::size_t idx) {
+        return std::uint64_t(1) << (idx % 64);
+    }
+
+    static bool claim_bit(bitmap &bits, std::size_t idx) {
+        return (bits[idx / 64].fetch_and(~bit(idx), std::memory_order_acquire) & bit(idx)) != 0;
+    }
+
+    static void release_bit(bitmap &bits, std::size_t idx) {
+        bits[idx / 64].fetch_or(bit(idx), std::memory_order_seq_cst);
+    }
+
+    std::size_t claim_from(bitmap &bits, std::size_t start) {
+        for (std::size_t i = 0; i < _words; i++) {
+            std::size_t w = (start + i) % _words;
+            std::uint64_t v = bits[w].load(std::memory_order_relaxed);
+            while (v) {
+                std::uint64_t m = v & (~v + 1);
+                std::uint64_t old = bits[w].fetch_and(~m, std::memory_order_acquire);
+                if (old & m) return w * 64 + std::countr_zero(m);
+                v = old & ~m;
+            }
+        }
+        return npos;
+    }
+
+    //claim a slot - prefer recently returned object, then any idle object, then empty slot
+    std::size_t claim() {
+        std::size_t start = 0;
+        if (_hint._pool == this) {
+            if (claim_bit(_idle, _hint._idx)) return _hint._idx;
+            start = _hint._idx / 64;
+        }
+        std::size_t idx = claim_from(_idle, start);
+        if (idx == npos) idx = claim_from(_empty, start);
+        return idx;
+    }
+
+    void create_if_needed(std::size_t idx) {
+        node &n = _nodes[idx];
+        if (!n._obj) n._obj = _factory();
+    }
+
+    void put_back(std::size_t idx, bool idle) {
+        if (idle) {
+            _nodes[idx]._last = clock::now();
+            _hint = {this, idx};
+            release_bit(_idle, idx);
+        } else {
+            release_bit(_empty, idx);
+        }
+        //pairs with the fence in enqueue()
+        if (_waiting.load(std::memory_order_seq_cst)) serve();
+    }
+
+    void deliver(promise<lease> &&p, std::size_t idx) {
+        try {
+            create_if_needed(idx);
+        } catch (...) {
+            put_back(idx, false);
+            p(std::current_exception());
+            return;
+        }
+        p(lease(this, idx));
+    }
+
+    void enqueue(promise<lease> &&p) {
+        {
+            std::lock_guard _(_mx);
+            if (_closed) {
+                p(std::make_exception_ptr(await_canceled_exception()));
+                return;
+            }
+            _queue.push_back(std::move(p));
+            _waiting.store(_queue.size(), std::memory_order_seq_cst);
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        //an object could be returned before the waiting flag was visible
+        serve();
+    }
+
+    void serve() {
+        std::vector<std::pair<promise<lease>, std::size_t> > ready;
+        {
+            std::lock_guard _(_mx);
+            while (!_queue.empty()) {
+                std::size_t idx = claim();
+                if (idx == npos) break;
+                ready.emplace_back(std::move(_queue.front()), idx);
+                _queue.pop_front();
+            }
+            _waiting.store(_queue.size(), std::memory_order_seq_cst);
+        }
+        for (auto &[p, idx]: ready) deliver(std::move(p), idx);
+    }
+};
+
+template<typename T>
+inline thread_local typename object_pool<T>::hint object_pool<T>::_hint;
+
+}
+
+#endif /* SRC_COCLASSES_OBJECT_POOL_H_ */
@@ -0,0 +1,446 @@
+/**
+ * @file pipeline.h
+ *
+ * Dataflow pipeline of stages connected by bounded queues
+ */
+#pragma once
+#ifndef SRC_COCLASSES_PIPELINE_H_
+#define SRC_COCLASSES_PIPELINE_H_
+
+#include "future.h"
+#include "generator.h"
+#include "mutex.h"
+#include "queue.h"
+#include "task.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace cocls {
+
+///Dataflow pipeline
+/**
+ * The pipeline is a chain of stages. The first stage is source (a generator), then
+ * follows any count of transform stages and the chain is terminated by a sink. Stages
+ * are connected by limited queues, so a slow stage blocks the stages before it
+ * (backpressure). Every stage runs specified count of workers on the thread pool.
+ *
+ * A transform stage with multiple workers can emit results in completion order (default)
+ * or in order of the source (ordered). Functions of stages can return the value directly or
+ * future of the value.
+ *
+ * If a function throws an exception, the item is dropped, the pipeline continues and the
+ * first exception is reported when the pipeline finishes.
+ *
+ * @code
+ * cocls::pipeline pl(pool);
+ * pl.source("read", [&]{return read_lines(file);})
+ *   .transform("parse", [](std::string ln){return parse(ln);}, {.parallelism = 4, .ordered = true})
+ *   .sink("store", [&](record r){return db.store(r);}, {.parallelism = 2});
+ * co_await pl.run();
+ * @endcode
+ *
+ * Counters of stages are available by stats(). The stage with full input queue and busy
+ * workers is the bottleneck.
+ *
+ * @note the pipeline can be run only once. It must not be destroyed while it is running
+ */
+class pipeline {
+public:
+
+    ///Options of a stage
+    struct options {
+        ///count of workers
+        unsigned int parallelism = 1;
+        ///emit results in order of the source (transform stage)
+        bool ordered = false;
+        ///capacity of the input queue
+        std::size_t capacity = 16;
+    };
+
+    ///Counters of a stage
+    struct stage_stats {
+        ///name of the stage
+        std::string name;
+        ///count of workers
+        unsigned int parallelism;
+        ///count of processed items
+        std::size_t processed;
+        ///count of workers executing the function now
+        std::size_t busy;
+        ///count of items in the input queue
+        std::size_t queued;
+        ///capacity of the input queue
+        std::size_t capacity;
+    };
+
+protected:
+
+    template<typename T>
+    struct packet {
+        //position in the source stream
+        std::size_t _seq = 0;
+        //empty for dropped items
+        std::optional<T> _value;
+        bool _eos = false;
+    };
+
+    template<typename T>
+    using channel = limited_queue<packet<T> >;
+
+    class stage_base {
+    public:
+        stage_base(pipeline &pl, std::string &&name, const options &opt)
+            :_pl(pl), _name(std::move(name)), _opt(opt) {
+            if (_opt.parallelism == 0) _opt.parallelism = 1;
+        }
+        virtual ~stage_base() = default;
+        virtual void start() = 0;
+        virtual std::size_t queued() {return 0;}
+        virtual std::size_t capacity() const {return 0;}
+
+        stage_stats stats() {
+            return {_name, _opt.parallelism, _processed.load(std::memory_order_relaxed),
+                    _busy.load(std::memory_order_relaxed), queued(), capacity()};
+        }
+
+        pipeline &_pl;
+        std::string _name;
+        options _opt;
+        std::atomic<std::size_t> _processed = 0;
+        std::atomic<std::size_t> _busy = 0;
+        std::atomic<unsigned int> _running = 0;
+    };
+
+    template<typename T>
+    class output_stage: public stage_base {
+    public:
+        using stage_base::stage_base;
+
+        channel<T> *_out = nullptr;
+        unsigned int _next_workers = 0;
+
+    protected:
+        std::mutex _reorder_mx;
+        std::map<std::size_t, packet<T> > _reorder;
+        std::size_t _next_seq = 0;
+        mutex _emit_mx;
+
+        future<void> emit(packet<T> &&pk) {
+            if (!this->_opt.ordered) {
+                co_await _out->push(std::move(pk));
+                co_return;
+            }
+            {
+                std::lock_guard _(_reorder_mx);
+                _reorder.emplace(pk._seq, std::move(pk));
+            }
+            //every depositor drains, so nothing stays in the buffer
+            auto own = co_await _emit_mx.lock();
+            for(;;) {
+                packet<T> p;
+                {
+                    std::lock_guard _(_reorder_mx);
+                    auto iter = _reorder.find(_next_seq);
+                    if (iter == _reorder.end()) break;
+                    p = std::move(iter->second);
+                    _reorder.erase(iter);
+                    ++_next_seq;
+                }
+                co_await _out->push(std::move(p));
+            }
+        }
+
+        //called by every worker at the end, the last worker closes the output
+        future<void> finish_worker() {
+            if (this->_running.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                for (unsigned int i = 0; i < _next_workers; i++) {
+                    co_await _out->push(packet<T>{0, {}, true});
+                }
+            }
+        }
+    };
+
+    template<typename T, typename Fn>
+    class source_stage: public output_stage<T> {
+    public:
+        source_stage(pipeline &pl, std::string &&name, Fn &&fn)
+            :output_stage<T>(pl, std::move(name), options()), _fn(std::forward<Fn>(fn)) {}
+
+        virtual void start() override {
+            this->_running = 1;
+            this->_pl.add_worker(worker());
+        }
+
+    protected:
+        std::decay_t<Fn> _fn;
+
+        task<> worker() {
+            co_await this->_pl._pool;
+            try {
+                auto gen = _fn();
+                std::size_t seq = 0;
+                while (co_await gen.next()) {
+                    this->_processed.fetch_add(1, std::memory_order_relaxed);
+                    co_await this->emit(packet<T>{seq++, std::move(gen.value()), false});
+                }
+            } catch (...) {
+                this->_pl.set_exception(std::current_exception());
+            }
+            co_await this->finish_worker();
+            this->_pl.worker_done();
+        }
+    };
+
+    template<typename In, typename Out, typename Fn>
+    class transform_stage: public output_stage<Out> {
+    public:
+        transform_stage(pipeline &pl, std::string &&name, Fn &&fn, const options &opt)
+            :output_stage<Out>(pl, std::move(name), opt)
+            ,_in(std::max<std::size_t>(opt.capacity, 1))
+            ,_fn(std::forward<Fn>(fn)) {}
+
+        virtual void start() override {
+            this->_running = this->_opt.parallelism;
+            for (unsigned int i = 0; i < this->_opt.parallelism; i++) this->_pl.add_worker(worker());
+        }
+        virtual std::size_t queued() override {return _in.size();}
+        virtual std::size_t capacity() const override {return this->_opt.capacity;}
+
+        channel<In> _in;
+
+    protected:
+        std::decay_t<Fn> _fn;
+
+        task<> worker() {
+            for(;;) {
+                packet<In> pk = std::move(co_await _in.pop());
+                if (pk._eos) break;
+                //continue on the pool, not in the thread of the producer
+                co_await this->_pl._pool;
+                packet<Out> res{pk._seq, {}, false};
+                if (pk._value.has_value()) {
+                    this->_busy.fetch_add(1, std::memory_order_relaxed);
+                    try {
+                        if constexpr(_details::IsFuture<std::decay_t<std::invoke_result_t<Fn &, In &&> > >::value) {
+                            res._value.emplace(std::move(co_await _fn(std::move(*pk._value))));
+                        } else {
+                            res._value.emplace(_fn(std::move(*pk._value)));
+                        }
+                        this->_processed.fetch_add(1, std::memory_order_relaxed);
+                    } catch (...) {
+                        this->_pl.set_exception(std::current_exception());
+                    }
+                    this->_busy.fetch_sub(1, std::memory_order_relaxed);
+                }
+                co_await this->emit(std::move(res));
+            }
+            co_await this->finish_worker();
+            this->_pl.worker_done();
+        }
+    };
+
+    template<typename In, typename Fn>
+    class sink_stage: public stage_base {
+    public:
+        sink_stage(pipeline &pl, std::string &&name, Fn &&fn, const options &opt)
+            :stage_base(pl, std::move(name), opt)
+            ,_in(std::max<std::size_t>(opt.capacity, 1))
+            ,_fn(std::forward<Fn>(fn)) {}
+
+        virtual void start() override {
+            for (unsigned int i = 0; i < this->_opt.parallelism; i++) this->_pl.add_worker(worker());
+        }
+        virtual std::size_t queued() override {return _in.size();}
+        virtual std::size_t capacity() const override {return this->_opt.capacity;}
+
+        channel<In> _in;
+
+    protected:
+        std::decay_t<Fn> _fn;
+
+        task<> worker() {
+            for(;;) {
+                packet<In> pk = std::move(co_await _in.pop());
+                if (pk._eos) break;
+                co_await this->_pl._pool;
+                if (!pk._value.has_value()) continue;
+                this->_busy.fetch_add(1, std::memory_order_relaxed);
+                try {
+                    if constexpr(_details::IsFuture<std::decay_t<std::invoke_result_t<Fn &, In &&> > >::value) {
+                        co_await _fn(std::move(*pk._value));
+                    } else {
+                        _fn(std::move(*pk._value));
+                    }
+                    this->_processed.fetch_add(1, std::memory_order_relaxed);
+                } catch (...) {
+                    this->_pl.set_exception(std::current_exception());
+                }
+                this->_busy.fetch_sub(1, std::memory_order_relaxed);
+            }
+            this->_pl.worker_done();
+        }
+    };
+
+    template<typename T>
+    struct generator_type;
+    template<typename T>
+    struct generator_type<generator<T> > {using type = T;};
+
+    template<typename R>
+    struct plain_result {using Type = R;};
+
+    //type of the value returned by the function, future<X> is unwrapped to X
+    template<typename Fn, typename In>
+    using transform_result_t = typename std::conditional_t<
+            _details::IsFuture<std::decay_t<std::invoke_result_t<Fn &, In &&> > >::value,
+            _details::IsFuture<std::decay_t<std::invoke_result_t<Fn &, In &&> > >,
+            plain_result<std::decay_t<std::invoke_result_t<Fn &, In &&> > > >::Type;
+
+public:
+
+    ///Builder of the chain, represents output of the last stage
+    template<typename T>
+    class node {
+    public:
+        ///Add transform stage
+        /**
+         * @param name name of the stage
+         * @param fn function which converts T to the new value. It can return future
+         * @param opt options
+         * @return node representing the output of the stage
+         */
+        template<typename Fn>
+        auto transform(std::string name, Fn &&fn, const options &opt = {}) {
+            using Out = typename transform_helper<Fn>::type;
+            auto st = std::make_unique<transform_stage<T, Out, Fn> >(_pl, std::move(name), std::forward<Fn>(fn), opt);
+            node<Out> n(_pl, st.get());
+            connect(st->_in, st->_opt.parallelism);
+            _pl._stages.push_back(std::move(st));
+            return n;
+        }
+
+        ///Add sink stage, terminates the chain
+        /**
+         * @param name name of the stage
+         * @param fn function which consumes T. It can return future<void>
+         * @param opt options (ordered is ignored)
+         * @return reference to the pipeline
+         */
+        template<typename Fn>
+        pipeline &sink(std::string name, Fn &&fn, const options &opt = {}) {
+            auto st = std::make_unique<sink_stage<T, Fn> >(_pl, std::move(name), std::forward<Fn>(fn), opt);
+            connect(st->_in, st->_opt.parallelism);
+            _pl._stages.push_back(std::move(st));
+            return _pl;
+        }
+
+    protected:
+        node(pipeline &pl, output_stage<T> *stage):_pl(pl), _stage(stage) {}
+
+        template<typename Fn>
+        struct transform_helper {
+            using type = transform_result_t<Fn, T>;
+        };
+
+        void connect(channel<T> &in, unsigned int workers) {
+            assert("Stage is already connected" && _stage->_out == nullptr);
+            _stage->_out = &in;
+            _stage->_next_workers = workers;
+        }
+
+        pipeline &_pl;
+        output_stage<T> *_stage;
+        friend class pipeline;
+        template<typename> friend class node;
+    };
+
+    ///Construct the pipeline
+    /**
+     * @param pool thread pool which runs workers of all stages
+     */
+    explicit pipeline(thread_pool &pool):_pool(pool) {}
+
+    pipeline(const pipeline &) = delete;
+    pipeline &operator=(const pipeline &) = delete;
+
+    ~pipeline() {
+        for (auto &t: _workers) t.join();
+    }
+
+    ///Add source stage
+    /**
+     * @param name name of the stage
+     * @param fn function which returns generator<T>
+     * @return node representing the output of the source
+     */
+    template<typename Fn>
+    auto source(std::string name, Fn &&fn) {
+        using T = typename generator_type<std::decay_t<std::invoke_result_t<Fn &> > >::type;
+        auto st = std::make_unique<source_stage<T, Fn> >(*this, std::move(name), std::forward<Fn>(fn));
+        node<T> n(*this, st.get());
+        _stages.push_back(std::move(st));
+        return n;
+    }
+
+    ///Run the pipeline
+    /**
+     * @return future which is resolved when the sink processes the last item. If any
+     * stage thrown an exception, the first exception is set to the future
+     */
+    future<void> run() {
+        return [&](auto promise) {
+            _done = std::move(promise);
+            _live = 0;
+            for (auto &s: _stages) _live += std::max(s->_opt.parallelism, 1U);
+            for (auto &s: _stages) s->start();
+        };
+    }
+
+    ///Retrieve counters of all stages
+    std::vector<stage_stats> stats() const {
+        std::vector<stage_stats> out;
+        for (auto &s: _stages) out.push_back(s->stats());
+        return out;
+    }
+
+protected:
+    thread_pool &_pool;
+    std::vector<std::unique_ptr<stage_base> > _stages;
+    std::mutex _mx;
+    std::vector<task<> > _workers;
+    std::atomic<std::size_t> _live = 0;
+    std::exception_ptr _exception;
+    promise<void> _done;
+
+    void add_worker(task<> &&t) {
+        std::lock_guard _(_mx);
+        _workers.push_back(std::move(t));
+    }
+
+    void set_exception(std::exception_ptr e) {
+        std::lock_guard _(_mx);
+        if (!_exception) _exception = std::move(e);
+    }
+
+    void worker_done() {
+        if (_live.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::exception_ptr e;
+            {
+                std::lock_guard _(_mx);
+                e = _exception;
+            }
+            if (e) _done(e); else _done();
+        }
+    }
+};
+
+}
+
+#endif /* SRC_COCLASSES_PIPELINE_H_ */
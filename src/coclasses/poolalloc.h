@@ -47,6 +47,7 @@
 #include <vector>
 #include <array>
 #include "common.h"
+#include "trace.h"
 
 
 
@@ -116,11 +117,11 @@ struct global_block_cache {
     std::atomic<block<sz> *> _chain;    
     
     block<sz> * swap_out_chain(block<sz> *chain) {
-        return _chain.exchange(chain, std::memory_order_relaxed);
+        return _chain.exchange(chain, std::memory_order_acq_rel);
     }
     bool swap_chain_in(block<sz> * mychain) {
         block<sz> *exp = nullptr;
-        return _chain.compare_exchange_strong(exp, mychain, std::memory_order_relaxed);
+        return _chain.compare_exchange_strong(exp, mychain, std::memory_order_release, std::memory_order_relaxed);
     }
     void gc() {
         auto x = swap_out_chain(nullptr);
@@ -154,6 +155,7 @@ struct thread_local_cache {
                 x =  _cache->swap_out_chain(nullptr);            
             
                 if (!x) [[unlikely]] {
+                    COCLS_TRACE1(poolalloc_miss, sz);
                     return ::operator new(sz);
                 }         
             }
@@ -168,6 +170,7 @@ struct thread_local_cache {
             //if cache is full, check for refill global cache
             if (_cache->swap_chain_in(_dropped)) {
                 //if refill succeed, put new item into empty local cache
+                b->next = nullptr;
                 _dropped = b;
                 _count = 1;
                 return;
@@ -0,0 +1,373 @@
+/**
+ * @file priority_channel.h
+ *
+ * Awaitable queue ordered by priority
+ */
+#pragma once
+#ifndef SRC_COCLASSES_PRIORITY_CHANNEL_H_
+#define SRC_COCLASSES_PRIORITY_CHANNEL_H_
+
+#include "future.h"
+#include "priority_queue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace cocls {
+
+namespace _details {
+
+template<typename T, typename Prio>
+class priority_channel_base {
+public:
+
+    static_assert(std::is_arithmetic_v<Prio>, "Priority must be arithmetic type");
+
+    using clock = std::chrono::steady_clock;
+
+    priority_channel_base(std::size_t limit, unsigned int shards, clock::duration aging)
+        :_limit(limit)
+        ,_nshards(std::max(shards, 1U))
+        ,_shards(std::make_unique<shard[]>(_nshards))
+        ,_aging(aging)
+        ,_start(clock::now()) {}
+
+    priority_channel_base(const priority_channel_base &) = delete;
+    priority_channel_base &operator=(const priority_channel_base &) = delete;
+
+    ///Pop the item with highest priority
+    /**
+     * @return future with the item. If the channel is empty, the future is resolved
+     * by the next push, which passes the item directly to the consumer.
+     */
+    future<T> pop() {
+        return [&](auto promise) {
+            if (auto v = take()) {
+                promise(std::move(*v));
+                release_blocked();
+                return;
+            }
+            {
+                std::lock_guard _(_wmx);
+                _awaiters.push_back(std::move(promise));
+                _nawaiters.fetch_add(1);
+            }
+            //an item could be pushed before the consumer was registered
+            drain();
+            //a producer could be blocked while the channel was emptied
+            release_blocked();
+        };
+    }
+
+    ///Count of items in the channel
+    std::size_t size() const {
+        return _count.load(std::memory_order_relaxed);
+    }
+
+    ///Determines whether the channel is empty
+    bool empty() const {
+        return size() == 0;
+    }
+
+    ///unblock first awaiting consumer with an exception
+    /**
+     * @param e exception
+     * @retval true success
+     * @retval false nobody is awaiting
+     */
+    bool unblock_pop(std::exception_ptr e) {
+        std::unique_lock lk(_wmx);
+        if (_awaiters.empty()) return false;
+        promise<T> p = std::move(_awaiters.front());
+        _awaiters.pop_front();
+        _nawaiters.fetch_sub(1);
+        lk.unlock();
+        p.set_exception(e);
+        return true;
+    }
+
+protected:
+
+    struct entry {
+        //effective priority including aging
+        double _key;
+        std::uint64_t _seq;
+        T _value;
+    };
+
+    struct entry_less {
+        bool operator()(const entry &a, const entry &b) const {
+            //equal priority - first in first out
+            return a._key < b._key || (a._key == b._key && a._seq > b._seq);
+        }
+    };
+
+    static constexpr double empty_key = -std::numeric_limits<double>::infinity();
+
+    struct alignas(64) shard {
+        std::mutex _mx;
+        priority_queue<entry, std::vector<entry>, entry_less> _q;
+        std::uint64_t _seq = 0;
+        //key of the top item, readable without lock. Publishing a new top in push and
+        //reading it in take() are seq_cst, see insert()
+        std::atomic<double> _top = empty_key;
+    };
+
+    struct blocked {
+        T _value;
+        Prio _prio;
+        promise<void> _promise;
+    };
+
+    std::size_t _limit;
+    unsigned int _nshards;
+    std::unique_ptr<shard[]> _shards;
+    clock::duration _aging;
+    clock::time_point _start;
+    std::atomic<std::size_t> _count = 0;
+    //protects awaiting consumers and blocked producers
+    std::mutex _wmx;
+    std::deque<promise<T> > _awaiters;
+    std::deque<blocked> _blocked;
+    std::atomic<std::size_t> _nawaiters = 0;
+    std::atomic<std::size_t> _nblocked = 0;
+
+    //Aging raises priority linearly with the time spent in the channel. The time of the pop
+    //is same for all items, so it is enough to order by priority - time of the push
+    double make_key(Prio prio) const {
+        double k = static_cast<double>(prio);
+        if (_aging.count() > 0) {
+            k -= std::chrono::duration<double>(clock::now() - _start) / _aging;
+        }
+        return k;
+    }
+
+    shard &push_shard() {
+        static thread_local std::size_t h = std::hash<std::thread::id>()(std::this_thread::get_id());
+        return _shards[h % _nshards];
+    }
+
+    void push_item(T &&value, Prio prio) {
+        insert(std::move(value), prio);
+        //space could be released while a producer was being blocked
+        release_blocked();
+    }
+
+    //passes the item to an awaiting consumer or inserts it to a shard
+    void insert(T &&value, Prio prio) {
+        if (_nawaiters.load() != 0) {
+            std::unique_lock lk(_wmx);
+            if (!_awaiters.empty()) {
+                promise<T> p = std::move(_awaiters.front());
+                _awaiters.pop_front();
+                _nawaiters.fetch_sub(1);
+                lk.unlock();
+                p(std::move(value));
+                return;
+            }
+        }
+        double key = make_key(prio);
+        shard &s = push_shard();
+        {
+            std::lock_guard _(s._mx);
+            s._q.push(entry{key, s._seq++, std::move(value)});
+            //counted before the item can be taken, so the count never underflows
+            _count.fetch_add(1);
+            //seq_cst pairs with registration of a consumer in pop(), at least one side
+            //sees the other
+            s._top.store(s._q.top()._key, std::memory_order_seq_cst);
+        }
+        //a consumer could start waiting before the item was pushed
+        if (_nawaiters.load() != 0) drain();
+    }
+
+    //takes item from the shard with the best top
+    std::optional<T> take() {
+        for(;;) {
+            shard *best = nullptr;
+            double best_key = empty_key;
+            for (unsigned int i = 0; i < _nshards; i++) {
+                double k = _shards[i]._top.load(std::memory_order_seq_cst);
+                if (k > best_key) {
+                    best_key = k;
+                    best = &_shards[i];
+                }
+            }
+            if (!best) return {};
+            std::lock_guard _(best->_mx);
+            if (best->_q.empty()) continue;
+            entry e = best->_q.pop_item();
+            best->_top.store(best->_q.empty()?empty_key:best->_q.top()._key, std::memory_order_relaxed);
+            _count.fetch_sub(1);
+            return std::optional<T>(std::move(e._value));
+        }
+    }
+
+    //passes items to awaiting consumers
+    void drain() {
+        std::vector<std::pair<promise<T>, T> > ready;
+        {
+            std::lock_guard _(_wmx);
+            while (!_awaiters.empty()) {
+                auto v = take();
+                if (!v) break;
+                ready.emplace_back(std::move(_awaiters.front()), std::move(*v));
+                _awaiters.pop_front();
+                _nawaiters.fetch_sub(1);
+            }
+        }
+        for (auto &[p, v]: ready) {
+            p(std::move(v));
+            release_blocked();
+        }
+    }
+
+    //moves blocked producers to the channel while there is a space
+    void release_blocked() {
+        while (_nblocked.load() != 0) {
+            std::unique_lock lk(_wmx);
+            if (_blocked.empty() || _count.load() >= _limit) return;
+            blocked b = std::move(_blocked.front());
+            _blocked.pop_front();
+            _nblocked.fetch_sub(1);
+            lk.unlock();
+            insert(std::move(b._value), b._prio);
+            b._promise();
+        }
+    }
+};
+
+}
+
+///Awaitable channel, consumers receive items with highest priority first
+/**
+ * Producers push items with a priority, consumers co_await pop(). An awaiting consumer
+ * receives the pushed item directly. Items with equal priority are served in the order
+ * of pushing.
+ *
+ * Optional aging prevents starvation of items with low priority. The priority of a
+ * waiting item is increased by one for each aging period. Aging doesn't need any
+ * periodic work, it is part of the ordering key.
+ *
+ * The channel can be divided to shards. Producers push to the shard selected by the
+ * thread, consumers take the item from the shard with the best top item, so producers
+ * don't contend on a single lock. Under concurrent access the order is relaxed, a consumer
+ * can receive an item which is not the best one at the time. With one shard (default) the
+ * order is strict.
+ *
+ * @code
+ * cocls::priority_channel<job> jobs(4, std::chrono::seconds(1));
+ * jobs.push(job{...}, 10);
+ *
+ * job j = co_await jobs.pop();
+ * @endcode
+ *
+ * @tparam T type of item
+ * @tparam Prio type of priority (arithmetic). Greater value means higher priority
+ */
+template<typename T, typename Prio = int>
+class priority_channel: public _details::priority_channel_base<T, Prio> {
+public:
+
+    using clock = typename _details::priority_channel_base<T, Prio>::clock;
+
+    ///Construct the channel
+    /**
+     * @param shards count of shards
+     * @param aging period after which the priority of a waiting item is increased by one.
+     * Zero disables aging
+     */
+    explicit priority_channel(unsigned int shards = 1, clock::duration aging = clock::duration::zero())
+        :_details::priority_channel_base<T, Prio>(std::numeric_limits<std::size_t>::max(), shards, aging) {}
+
+    ///Push item
+    /**
+     * @param value item
+     * @param prio priority
+     */
+    void push(T value, Prio prio) {
+        this->push_item(std::move(value), prio);
+    }
+};
+
+///Awaitable priority channel with limited size
+/**
+ * When the channel is full, the producer is suspended until a consumer takes an item.
+ * Suspended producers are released in the order of arrival.
+ *
+ * @tparam T type of item
+ * @tparam Prio type of priority
+ *
+ * @see priority_channel
+ *
+ * @note Concurrent producers can exceed the limit by count of producers
+ */
+template<typename T, typename Prio = int>
+class limited_priority_channel: public _details::priority_channel_base<T, Prio> {
+public:
+
+    using clock = typename _details::priority_channel_base<T, Prio>::clock;
+
+    ///Construct the channel
+    /**
+     * @param limit maximum count of items
+     * @param shards count of shards
+     * @param aging period after which the priority of a waiting item is increased by one.
+     * Zero disables aging
+     */
+    explicit limited_priority_channel(std::size_t limit, unsigned int shards = 1, clock::duration aging = clock::duration::zero())
+        :_details::priority_channel_base<T, Prio>(std::max<std::size_t>(limit, 1), shards, aging) {}
+
+    ///Push item
+    /**
+     * @param value item
+     * @param prio priority
+     * @return future, which must be co_awaited. It is resolved when the item was inserted
+     */
+    future<void> push(T value, Prio prio) {
+        if (this->_count.load() < this->_limit) {
+            this->push_item(std::move(value), prio);
+            return future<void>::set_value();
+        }
+        return [&](auto promise) {
+            {
+                std::lock_guard _(this->_wmx);
+                this->_blocked.push_back({std::move(value), prio, std::move(promise)});
+                this->_nblocked.fetch_add(1);
+            }
+            //a consumer could take an item before the producer was registered
+            this->release_blocked();
+        };
+    }
+
+    ///unblock first suspended producer with an exception, its item is dropped
+    /**
+     * @param e exception
+     * @retval true success
+     * @retval false no producer is suspended
+     */
+    bool unblock_push(std::exception_ptr e) {
+        std::unique_lock lk(this->_wmx);
+        if (this->_blocked.empty()) return false;
+        auto b = std::move(this->_blocked.front());
+        this->_blocked.pop_front();
+        this->_nblocked.fetch_sub(1);
+        lk.unlock();
+        b._promise.set_exception(e);
+        return true;
+    }
+};
+
+}
+
+#endif /* SRC_COCLASSES_PRIORITY_CHANNEL_H_ */
@@ -0,0 +1,223 @@
+/**
+ * @file rate_limiter.h
+ *
+ * Token bucket rate limiter
+ */
+#pragma once
+#ifndef SRC_COCLASSES_RATE_LIMITER_H_
+#define SRC_COCLASSES_RATE_LIMITER_H_
+
+#include "future.h"
+#include "scheduler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace cocls {
+
+///Token bucket rate limiter
+/**
+ * The bucket is refilled by `rate` tokens per second and it can hold up to `burst` tokens.
+ * The coroutine acquires tokens by co_await acquire(n). If there are enough tokens,
+ * the future is already resolved and the coroutine continues without suspension.
+ *
+ * The bucket is implemented as GCRA (generic cell rate algorithm). Its whole state is
+ * single atomic variable - theoretical arrival time - so the fast path is just one CAS
+ * operation.
+ *
+ * When there are not enough tokens, the caller is put to FIFO of waiters. Only the first
+ * waiter has a timer in the scheduler, it is scheduled at time when its tokens become
+ * available. When it fires, all waiters which fit to the bucket are released and the timer
+ * is scheduled for the next waiter. So there is always at most one timer regardless on count
+ * of waiting coroutines. While there are waiters, the fast path is disabled to keep the FIFO
+ * order
+ *
+ * @code
+ * cocls::rate_limiter limiter(sch, 100, 10); //100 per second, burst 10
+ *
+ * cocls::task<> call(cocls::rate_limiter &limiter) {
+ *      co_await limiter.acquire();
+ *      //perform call
+ * }
+ * @endcode
+ *
+ * @note scheduler must outlive the limiter. Destruction of the limiter cancels all waiters
+ * (await_canceled_exception)
+ */
+class rate_limiter {
+public:
+
+    ///Construct the limiter
+    /**
+     * @param sch scheduler used to wake up waiters
+     * @param rate count of tokens per second
+     * @param burst maximum count of tokens which can be acquired at once (capacity of the bucket)
+     */
+    rate_limiter(scheduler &sch, double rate, unsigned int burst = 1)
+        :_state(std::make_shared<state>(sch, rate, burst)) {}
+
+    rate_limiter(const rate_limiter &) = delete;
+    rate_limiter &operator=(const rate_limiter &) = delete;
+
+    ~rate_limiter() {
+        _state->close();
+    }
+
+    ///Acquire tokens
+    /**
+     * @param n count of tokens. If n is greater than burst, the caller waits until the
+     * bucket is full and then the bucket is overdrawn
+     * @return future which is resolved when tokens are acquired. If tokens are available,
+     * the future is already resolved
+     */
+    future<void> acquire(unsigned int n = 1) {
+        return [&](auto promise) {
+            if (_state->try_acquire(n)) promise();
+            else _state->enqueue(n, std::move(promise));
+        };
+    }
+
+    ///Acquire tokens without waiting
+    /**
+     * @param n count of tokens
+     * @retval true acquired
+     * @retval false not enough tokens, or there are waiters
+     */
+    bool try_acquire(unsigned int n = 1) {
+        return _state->try_acquire(n);
+    }
+
+    ///Returns count of waiting callers
+    std::size_t waiting() const {
+        return _state->_waiting.load(std::memory_order_relaxed);
+    }
+
+protected:
+
+    using clock = std::chrono::steady_clock;
+
+    class state: public std::enable_shared_from_this<state> {
+    public:
+        state(scheduler &sch, double rate, unsigned int burst)
+            :_sch(sch)
+            ,_interval(static_cast<std::int64_t>(1e9 / std::max(rate, 1e-9)))
+            ,_tau(_interval * std::max(burst, 1U)) {}
+
+        bool try_acquire(unsigned int n) {
+            return _waiting.load(std::memory_order_acquire) == 0 && try_reserve(n, now());
+        }
+
+        void enqueue(unsigned int n, promise<void> &&p) {
+            std::unique_lock lk(_mx);
+            if (_closed) {
+                p(std::make_exception_ptr(await_canceled_exception()));
+                return;
+            }
+            if (_queue.empty() && try_reserve(n, now())) {
+                lk.unlock();
+                p();
+                return;
+            }
+            _queue.push_back({n, std::move(p)});
+            _waiting.store(_queue.size(), std::memory_order_release);
+            arm_timer();
+        }
+
+        void close() {
+            std::deque<waiter> q;
+            {
+                std::lock_guard _(_mx);
+                _closed = true;
+                std::swap(q, _queue);
+                _waiting.store(0, std::memory_order_relaxed);
+            }
+            _sch.cancel(this);
+            for (auto &w: q) {
+                w._promise(std::make_exception_ptr(await_canceled_exception()));
+            }
+        }
+
+        std::atomic<std::size_t> _waiting = 0;
+
+    protected:
+
+        struct waiter {
+            unsigned int _n;
+            promise<void> _promise;
+        };
+
+        scheduler &_sch;
+        std::int64_t _interval;
+        std::int64_t _tau;
+        //theoretical arrival time (ns)
+        std::atomic<std::int64_t> _tat = 0;
+        std::mutex _mx;
+        std::deque<waiter> _queue;
+        bool _timer_armed = false;
+        bool _closed = false;
+
+        static std::int64_t now() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    clock::now().time_since_epoch()).count();
+        }
+
+        std::int64_t limit(std::int64_t cost) const {
+            return std::max(_tau, cost);
+        }
+
+        bool try_reserve(unsigned int n, std::int64_t tp) {
+            std::int64_t cost = _interval * n;
+            std::int64_t tat = _tat.load(std::memory_order_relaxed);
+            for(;;) {
+                std::int64_t ntat = std::max(tat, tp) + cost;
+                if (ntat - tp > limit(cost)) return false;
+                if (_tat.compare_exchange_weak(tat, ntat, std::memory_order_relaxed)) return true;
+            }
+        }
+
+        //schedule timer for the first waiter (under lock)
+        void arm_timer() {
+            if (_timer_armed || _queue.empty()) return;
+            std::int64_t cost = _interval * _queue.front()._n;
+            std::int64_t wait = _tat.load(std::memory_order_relaxed) + cost - limit(cost) - now();
+            _timer_armed = true;
+            _sch.schedule(this, make_promise<void>([me = this->shared_from_this()](future<void> &f){
+                me->on_timer(f);
+            }), std::chrono::system_clock::now() + std::chrono::nanoseconds(std::max<std::int64_t>(wait, 0)));
+        }
+
+        void on_timer(future<void> &f) {
+            try {
+                f.value();
+            } catch (...) {
+                //canceled
+                return;
+            }
+            std::vector<promise<void> > ready;
+            {
+                std::lock_guard _(_mx);
+                _timer_armed = false;
+                auto tp = now();
+                while (!_queue.empty() && try_reserve(_queue.front()._n, tp)) {
+                    ready.push_back(std::move(_queue.front()._promise));
+                    _queue.pop_front();
+                }
+                _waiting.store(_queue.size(), std::memory_order_release);
+                if (!_closed) arm_timer();
+            }
+            for (auto &p: ready) p();
+        }
+    };
+
+    std::shared_ptr<state> _state;
+};
+
+}
+
+#endif /* SRC_COCLASSES_RATE_LIMITER_H_ */
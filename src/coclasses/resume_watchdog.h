@@ -0,0 +1,236 @@
+/**
+ * @file resume_watchdog.h
+ *
+ * Detects long running resumptions
+ *
+ * A coroutine which blocks on a syscall or performs CPU heavy loop inside of thread_pool's
+ * worker or dispatcher's thread stalls all coroutines enqueued behind it. The watchdog
+ * allows to find such coroutines.
+ *
+ * Each monitored thread owns a slot, where it writes start time of current resumption and
+ * identity of the resumed coroutine (relaxed stores only). The watchdog runs in own thread,
+ * periodically checks all slots and reports resumptions running longer than threshold.
+ * Each resumption is reported only once.
+ *
+ * @code
+ * cocls::resume_watchdog wd(std::chrono::milliseconds(50));
+ * cocls::thread_pool pool(4, wd);
+ * @endcode
+ *
+ * @note the watchdog must outlive all objects attached to it.
+ */
+#pragma once
+#ifndef SRC_COCLASSES_RESUME_WATCHDOG_H_
+#define SRC_COCLASSES_RESUME_WATCHDOG_H_
+
+#include "debug.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+namespace cocls {
+
+class resume_watchdog {
+public:
+
+    ///Information about stalled resumption
+    struct report {
+        ///name of the monitored object (thread_pool, dispatcher)
+        const char *source;
+        ///thread where resumption is running
+        std::thread::id thread;
+        ///identity of the resumed coroutine (address of its frame). Can be nullptr, if
+        /// the thread runs a function, not a coroutine
+        const void *ident;
+        ///how long the resumption is running
+        std::chrono::nanoseconds duration;
+    };
+
+    using callback = std::function<void(const report &)>;
+
+    ///Slot of one monitored thread
+    class slot {
+    public:
+        slot(const char *source):_source(source), _thread(std::this_thread::get_id()) {}
+
+        ///called before the resumption
+        /**
+         * @param ident identity of resumed coroutine
+         */
+        void begin(const void *ident) noexcept {
+            _ident.store(ident, std::memory_order_relaxed);
+            _start.store(now(), std::memory_order_relaxed);
+        }
+        ///called after the resumption
+        void end() noexcept {
+            _start.store(0, std::memory_order_relaxed);
+        }
+
+    protected:
+        std::atomic<std::int64_t> _start = 0;
+        std::atomic<const void *> _ident = nullptr;
+        std::int64_t _reported = 0;
+        const char *_source;
+        std::thread::id _thread;
+        friend class resume_watchdog;
+    };
+
+    ///Registration of the thread. Detaches the slot on destruction
+    class registration {
+    public:
+        registration() = default;
+        registration(resume_watchdog *owner, slot *s):_owner(owner), _slot(s) {}
+        registration(registration &&other):_owner(other._owner), _slot(other._slot) {
+            other._slot = nullptr;
+        }
+        registration &operator=(registration &&other) {
+            if (this != &other) {
+                reset();
+                _owner = other._owner;
+                _slot = other._slot;
+                other._slot = nullptr;
+            }
+            return *this;
+        }
+        ~registration() {
+            reset();
+        }
+        void reset() {
+            if (_slot) _owner->detach(_slot);
+            _slot = nullptr;
+        }
+        slot *get() const {return _slot;}
+        explicit operator bool() const {return _slot != nullptr;}
+
+    protected:
+        resume_watchdog *_owner = nullptr;
+        slot *_slot = nullptr;
+    };
+
+    ///Marks single resumption (RAII)
+    class scope {
+    public:
+        scope(slot *s, const void *ident):_s(s) {
+            if (_s) _s->begin(ident);
+        }
+        scope(const registration &reg, const void *ident):scope(reg.get(), ident) {}
+        scope(const scope &) = delete;
+        scope &operator=(const scope &) = delete;
+        ~scope() {
+            if (_s) _s->end();
+        }
+    protected:
+        slot *_s;
+    };
+
+    ///Start the watchdog
+    /**
+     * @param threshold maximum allowed duration of single resumption
+     * @param cb callback called for every resumption exceeding the threshold. It is
+     * called from the watchdog's thread. Default callback prints the report to stderr. The
+     * callback must not attach or detach threads
+     * @param check_interval how often the slots are checked. Default value is quarter
+     * of threshold
+     */
+    template<typename A, typename B>
+    resume_watchdog(std::chrono::duration<A,B> threshold, callback cb = default_callback,
+            std::chrono::nanoseconds check_interval = std::chrono::nanoseconds(0))
+        :_threshold(std::chrono::duration_cast<std::chrono::nanoseconds>(threshold).count())
+        ,_interval(check_interval.count()?check_interval:std::chrono::nanoseconds(std::max<std::int64_t>(_threshold/4,1)))
+        ,_cb(std::move(cb))
+    {
+        _thr = std::thread([this]{worker();});
+    }
+
+    resume_watchdog(const resume_watchdog &) = delete;
+    resume_watchdog &operator=(const resume_watchdog &) = delete;
+
+    ~resume_watchdog() {
+        {
+            std::lock_guard _(_mx);
+            _exit = true;
+            _cond.notify_all();
+        }
+        _thr.join();
+    }
+
+    ///Attach current thread
+    /**
+     * @param source name of the monitored object, must be static string
+     * @return registration, hold it while thread is monitored
+     */
+    registration attach(const char *source) {
+        std::lock_guard _(_mx);
+        _slots.emplace_back(source);
+        return registration(this, &_slots.back());
+    }
+
+    ///Default callback, prints the report to stderr
+    static void default_callback(const report &r) {
+        std::ostringstream s;
+        s << "cocls: resume_watchdog: " << r.source << " thread " << r.thread
+          << " is running coroutine " << r.ident;
+#ifdef COCLS_DEFINE_SET_CORO_NAME
+        if (r.ident) {
+            auto coros = debug_reporter::current_instance->get_running_coros();
+            auto iter = coros.find(std::coroutine_handle<>::from_address(const_cast<void *>(r.ident)));
+            if (iter != coros.end()) {
+                s << " (" << iter->second.fn << " - " << iter->second.loc << " " << iter->second.name << ")";
+            }
+        }
+#endif
+        s << " for " << std::chrono::duration_cast<std::chrono::microseconds>(r.duration).count() << " us\n";
+        auto str = s.str();
+        std::fwrite(str.data(), 1, str.size(), stderr);
+    }
+
+protected:
+
+    std::int64_t _threshold;
+    std::chrono::nanoseconds _interval;
+    callback _cb;
+    std::mutex _mx;
+    std::condition_variable _cond;
+    std::list<slot> _slots;
+    bool _exit = false;
+    std::thread _thr;
+
+    static std::int64_t now() noexcept {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void detach(slot *s) {
+        std::lock_guard _(_mx);
+        _slots.remove_if([&](const slot &x){return &x == s;});
+    }
+
+    void worker() {
+        std::unique_lock lk(_mx);
+        while (!_cond.wait_for(lk, _interval, [&]{return _exit;})) {
+            auto tp = now();
+            for (slot &s: _slots) {
+                auto start = s._start.load(std::memory_order_relaxed);
+                if (start && start != s._reported && tp - start > _threshold) {
+                    s._reported = start;
+                    report r{s._source, s._thread, s._ident.load(std::memory_order_relaxed),
+                        std::chrono::nanoseconds(tp - start)};
+                    _cb(r);
+                }
+            }
+        }
+    }
+};
+
+}
+
+#endif /* SRC_COCLASSES_RESUME_WATCHDOG_H_ */
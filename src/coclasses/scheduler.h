@@ -10,11 +10,14 @@
 #include "exceptions.h"
 
 #include "thread_pool.h"
+#include "trace.h"
 
 #include "generator.h"
+#include <chrono>
 #include <condition_variable>
 #include <functional>
 #include <optional>
+#include <stop_token>
 #include <variant>
 #include <vector>
 
@@ -51,6 +54,27 @@ public:
     ///For manual scheduling, this type caries expired promise, or time of nearest event
     using expired = std::variant<std::chrono::system_clock::time_point, promise>;
 
+    ///Timer slot, which can be canceled without searching
+    /**
+     * The timer is registered by schedule(timer &, promise, time_point). The scheduler
+     * keeps position of its entry updated, so cancel(timer &) doesn't need to search
+     * the queue. The canceled entry is erased from the queue in O(log n). The object is
+     * intended to be embedded into an awaiter
+     *
+     * @note the timer must not be destroyed while it is scheduled
+     */
+    class timer {
+    public:
+        timer() = default;
+        timer(const timer &) = delete;
+        timer &operator=(const timer &) = delete;
+    protected:
+        static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+        //position in the queue (guarded by scheduler's mutex)
+        std::size_t _index = npos;
+        friend class scheduler;
+    };
+
     ///Construct inactive scheduler
     scheduler() = default;
     ///Construct scheduler and  immediately start it in a thread pool
@@ -84,14 +108,22 @@ public:
      */
     void schedule(ident id, promise p, std::chrono::system_clock::time_point tp) {
           std::lock_guard _(_mx);
-          bool ntf = _scheduled.empty() || _scheduled[0]._tp > tp;
-          _scheduled.push_back({tp, std::move(p), id});
-          std::push_heap(_scheduled.begin(), _scheduled.end(), compare_item);
-          if (ntf) {
-              _cond.notify_all();
-          }
+          push_item({tp, std::move(p), id});
       }
 
+    ///Schedule a promise using a timer slot
+    /**
+     * @param t timer slot. It is used as identifier as well. The slot can be reused
+     * after the promise is resolved or canceled
+     * @param p promise to resolve
+     * @param tp time point when resolve the promise
+     */
+    void schedule(timer &t, promise p, std::chrono::system_clock::time_point tp) {
+        std::lock_guard _(_mx);
+        assert("Timer is already scheduled" && t._index == timer::npos);
+        push_item({tp, std::move(p), &t, &t});
+    }
+
     ///Retrieves first expired promise or calculates time-point of first expiration
     /**
      * Useful for manual scheduling. If there is expired promise, it is removed and returned.
@@ -123,13 +155,13 @@ public:
     promise remove(ident id) {
         std::lock_guard _(_mx);
         if (_scheduled.empty()) return {};
-        while (_scheduled[0]._ident == id) {
+        while (!_scheduled.empty() && _scheduled[0]._ident == id) {
             auto p = std::move(_scheduled[0]._p);
             pop_item();
             if (p) return p;
         }
         SchVector::iterator iter = std::find_if(_scheduled.begin(), _scheduled.end(),[&](const SchItem &x) {
-            return x._ident == id;
+            return x._ident == id && x._p;
         });
         if (iter == _scheduled.end()) return {};
         return std::move(iter->_p);
@@ -194,16 +226,39 @@ public:
      */
     bool cancel(ident id, std::exception_ptr e) {
         auto p = remove(id);
-        if (p) {
-            if (_glob_state.has_value() && _glob_state->_pool) {
-                _glob_state->_pool->resolve(p, e);
-            } else {
-                p(e);
-            }
-            return true;
-        } else {
-            return false;
-        }
+        return resolve_canceled(p, e);
+    }
+
+    ///cancel scheduled timer
+    /**
+     * Complexity is O(log n), the entry is not searched
+     *
+     * @param t timer slot
+     * @param e exception which will be thrown
+     * @retval true canceled
+     * @retval false timer is not scheduled, it could already fire
+     *
+     * @note associated promise is resolved in current thread, not in scheduler's thread
+     */
+    bool cancel(timer &t, std::exception_ptr e = std::make_exception_ptr(await_canceled_exception())) {
+        promise p = remove(t);
+        return resolve_canceled(p, e);
+    }
+
+    ///Remove scheduled timer
+    /**
+     * Complexity is O(log n), the entry is not searched
+     *
+     * @param t timer slot
+     * @return removed promise. If the timer is not scheduled, result is empty promise. The
+     * slot can be scheduled again immediately.
+     */
+    promise remove(timer &t) {
+        std::lock_guard _(_mx);
+        if (t._index == timer::npos) return {};
+        promise p = std::move(_scheduled[t._index]._p);
+        erase_item(t._index);
+        return p;
     }
 
     ///Starts the scheduler in current thread
@@ -259,6 +314,103 @@ public:
         thr.detach();
     }
 
+    ///Policy of fixed rate generator when the consumer misses a tick
+    enum class missed_tick {
+        ///missed ticks are generated immediately one after another, then the rate continues
+        burst,
+        ///missed ticks are skipped, the counter is increased by count of skipped ticks
+        skip,
+        ///the late tick is generated immediately and the schedule is shifted by the delay
+        delay
+    };
+
+    ///Creates generator of ticks at fixed rate
+    /**
+     * Ticks are generated at start + n*period, so the time spent by processing
+     * the tick doesn't accumulate. Times are calculated using steady clock. If the processing
+     * takes longer than the period, ticks are handled according to the policy
+     *
+     * Only the schedule of ticks is steady. The scheduler's queue runs on system clock,
+     * the deadline of the tick is converted when the timer is armed. A tick fired early
+     * because the system clock was stepped forward is armed again. A tick pending while
+     * the system clock is stepped back fires late by the step.
+     *
+     * The generator uses single timer slot in the scheduler, each tick costs one
+     * operation on the queue. If the tick is already late, it is generated without
+     * scheduling.
+     *
+     * @param period period
+     * @param policy what to do with missed ticks
+     * @param token stop token which can be used to stop generation
+     * @return generator of tick numbers (starting by zero)
+     *
+     * The generator must be destroyed by owner when the generator is paused on co_yield.
+     * If you need to stop it while its waiting on the tick, you can use stop token.
+     */
+    template<typename A, typename B>
+    generator<std::size_t> fixed_rate(std::chrono::duration<A,B> period, missed_tick policy = missed_tick::skip, std::stop_token token = {}) {
+        auto per = std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+        if (per.count() <= 0) per = std::chrono::steady_clock::duration(1);
+        timer tm;
+        std::stop_callback stpc(token,[&]{cancel(tm);});
+        std::size_t counter = 0;
+        auto next = std::chrono::steady_clock::now() + per;
+        try {
+            while (!token.stop_requested()) {
+                //a step of the system clock can fire the timer early
+                while (std::chrono::steady_clock::now() < next) co_await wait_tick(tm, next, token);
+                co_yield counter;
+                ++counter;
+                next += per;
+                auto now = std::chrono::steady_clock::now();
+                if (next < now) {
+                    switch (policy) {
+                        default:
+                        case missed_tick::burst: break;
+                        case missed_tick::skip: {
+                            auto missed = static_cast<std::size_t>((now - next) / per) + 1;
+                            counter += missed;
+                            next += per * missed;
+                        } break;
+                        case missed_tick::delay:
+                            next = now;
+                            break;
+                    }
+                }
+            }
+        } catch (const await_canceled_exception &) {
+            //empty
+        }
+    }
+
+    ///Creates generator of ticks with fixed delay between ticks
+    /**
+     * The delay is measured from the time when the consumer requests the next tick, so the
+     * delay is inserted between processing of ticks. Steps of the system clock affect
+     * the delay in the same way as in fixed_rate()
+     *
+     * @param delay delay
+     * @param token stop token which can be used to stop generation
+     * @return generator of tick numbers (starting by zero)
+     */
+    template<typename A, typename B>
+    generator<std::size_t> fixed_delay(std::chrono::duration<A,B> delay, std::stop_token token = {}) {
+        auto dl = std::chrono::duration_cast<std::chrono::steady_clock::duration>(delay);
+        timer tm;
+        std::stop_callback stpc(token,[&]{cancel(tm);});
+        std::size_t counter = 0;
+        try {
+            while (!token.stop_requested()) {
+                auto next = std::chrono::steady_clock::now() + dl;
+                while (std::chrono::steady_clock::now() < next) co_await wait_tick(tm, next, token);
+                co_yield counter;
+                ++counter;
+            }
+        } catch (const await_canceled_exception &) {
+            //empty
+        }
+    }
+
     ///Creates generator of intervals
     /**
      * @param dur duration of interval.
@@ -266,37 +418,20 @@ public:
      * @return generator
      *
      * the generator can be called which returns future. This future is resolved after
-     * given interval. Then generator is stopped until it is called again. The interval calculation
-     * is made before co_yield, so if the processing of the tick is shorter then tick
+     * given interval. Then generator is stopped until it is called again. The ticks are
+     * generated at fixed rate, so if the processing of the tick is shorter then tick
      * itself, you can achieve precise ticking regardless on how long you process each tick.
+     * When the tick is late, the schedule is shifted.
      *
      * The generator must be destroyed by owner when the generator is paused on co_yield.
      * If you need to stop it while its waiting on interval, you can use stop token. Activating
      * stop token causes that generator finishes generation as soon as possible.
      *
+     * @see fixed_rate
      */
     template<typename A, typename B>
     generator<std::size_t> interval(std::chrono::duration<A,B> dur, std::stop_token token = {}) {
-        bool tag;
-        std::stop_callback stpc(token,[&]{
-            std::lock_guard _(_mx);
-            this->cancel(&tag);
-        });
-        std::size_t counter;
-        future<void> waiter;
-        std::chrono::system_clock::time_point next = std::chrono::system_clock::now()+dur;
-        try {
-            while (!token.stop_requested()) {
-                waiter << [&]{return this->sleep_until(next, &tag);};
-                co_await waiter;
-                next = std::chrono::system_clock::now()+dur;
-                co_yield counter;
-                ++counter;
-            }
-
-        } catch (const await_canceled_exception &) {
-            //empty
-        }
+        return fixed_rate(dur, missed_tick::delay, std::move(token));
     }
 
 
@@ -313,6 +448,7 @@ protected:
         std::chrono::system_clock::time_point _tp;
         promise _p;
         ident _ident = nullptr;
+        timer *_timer = nullptr;
 
     };
 
@@ -334,9 +470,84 @@ protected:
         return a._tp > b._tp;
     }
 
+    //heap operations keep positions of timers updated
+
+    void place(std::size_t idx, SchItem &&item) {
+        SchItem &x = _scheduled[idx];
+        x = std::move(item);
+        if (x._timer) x._timer->_index = idx;
+    }
+
+    void sift_up(std::size_t idx) {
+        SchItem x = std::move(_scheduled[idx]);
+        while (idx > 0) {
+            std::size_t parent = (idx - 1) / 2;
+            if (!compare_item(_scheduled[parent], x)) break;
+            place(idx, std::move(_scheduled[parent]));
+            idx = parent;
+        }
+        place(idx, std::move(x));
+    }
+
+    void sift_down(std::size_t idx) {
+        SchItem x = std::move(_scheduled[idx]);
+        std::size_t n = _scheduled.size();
+        for(;;) {
+            std::size_t child = idx * 2 + 1;
+            if (child >= n) break;
+            if (child + 1 < n && compare_item(_scheduled[child], _scheduled[child + 1])) ++child;
+            if (!compare_item(x, _scheduled[child])) break;
+            place(idx, std::move(_scheduled[child]));
+            idx = child;
+        }
+        place(idx, std::move(x));
+    }
+
+    void push_item(SchItem &&item) {
+        bool ntf = _scheduled.empty() || _scheduled[0]._tp > item._tp;
+        _scheduled.push_back(std::move(item));
+        sift_up(_scheduled.size() - 1);
+        if (ntf) {
+            _cond.notify_all();
+        }
+    }
+
     void pop_item() {
-        std::pop_heap(_scheduled.begin(), _scheduled.end(), compare_item);
+        erase_item(0);
+    }
+
+    //removes item at given position, the last item is moved to its place
+    void erase_item(std::size_t idx) {
+        if (_scheduled[idx]._timer) _scheduled[idx]._timer->_index = timer::npos;
+        SchItem last = std::move(_scheduled.back());
         _scheduled.pop_back();
+        if (idx < _scheduled.size()) {
+            bool up = idx > 0 && compare_item(_scheduled[(idx - 1) / 2], last);
+            place(idx, std::move(last));
+            if (up) sift_up(idx); else sift_down(idx);
+        }
+    }
+
+    //waits for the tick using the timer slot, time is converted from steady clock
+    future<void> wait_tick(timer &tm, std::chrono::steady_clock::time_point tp, const std::stop_token &token) {
+        auto now = std::chrono::steady_clock::now();
+        if (tp <= now) return future<void>::set_value();
+        return [&](promise p) {
+            schedule(tm, std::move(p), std::chrono::system_clock::now()
+                    + std::chrono::duration_cast<std::chrono::system_clock::duration>(tp - now));
+            //stop requested before the timer was scheduled
+            if (token.stop_requested()) cancel(tm);
+        };
+    }
+
+    bool resolve_canceled(promise &p, std::exception_ptr e) {
+        if (!p) return false;
+        if (_glob_state.has_value() && _glob_state->_pool) {
+            _glob_state->_pool->resolve(p, e);
+        } else {
+            p(e);
+        }
+        return true;
     }
 
     template<typename Policy>
@@ -357,7 +568,14 @@ protected:
             std::visit([&](auto &x){
                using T = std::decay_t<decltype(x)>;
                if constexpr(std::is_same_v<T, promise>) {
-                   if (pool) pool->resolve(x); else x(); //resolve if pool defined, use pool
+                   COCLS_TRACE2(timer_fire, this, _scheduled.size());
+                   //resolve outside of the lock, the resumed code can schedule again
+                   {
+                       promise t = std::move(x);
+                       lk.unlock();
+                       if (pool) pool->resolve(t); else t(); //resolve if pool defined, use pool
+                   }
+                   lk.lock();
                } else {
                    if (Policy::can_block()) {
                        _cond.wait_until(lk, x);
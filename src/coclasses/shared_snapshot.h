@@ -0,0 +1,309 @@
+/**
+ * @file shared_snapshot.h
+ *
+ * Read-mostly shared data with epoch based reclamation
+ */
+#pragma once
+#ifndef SRC_COCLASSES_SHARED_SNAPSHOT_H_
+#define SRC_COCLASSES_SHARED_SNAPSHOT_H_
+
+#include "future.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace cocls {
+
+namespace _details {
+
+///Epoch based reclamation shared by all snapshots
+/**
+ * Every thread has a record with the epoch in which it entered the read section (0 if
+ * it is not reading). Retired objects are tagged by the global epoch and they are
+ * deleted when all active records are newer. Reading threads never wait and never lock.
+ *
+ * Retired objects are deleted and waiters are resolved by a scan, which runs in retire()
+ * and synchronize(). While a waiter exists, a reader entering or leaving its read section
+ * hands a new scan off to the thread pool of the reader. The hand-off is done by one reader
+ * until the scan starts.
+ */
+class ebr_domain {
+public:
+
+    static ebr_domain &instance() {
+        static ebr_domain d;
+        return d;
+    }
+
+    void pin() {
+        record *r = local_record();
+        if (r->_nest++ == 0) {
+            r->_epoch.store(_epoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            //ordered by the fence, a waiter which missed the end of previous read section
+            //of this thread is seen here
+            if (_nwaiters.load(std::memory_order_relaxed)) [[unlikely]] request_scan();
+        }
+    }
+
+    void unpin() {
+        record *r = _local.rec;
+        if (--r->_nest == 0) {
+            r->_epoch.store(0, std::memory_order_release);
+            if (_nwaiters.load(std::memory_order_relaxed)) [[unlikely]] request_scan();
+        }
+    }
+
+    ///Retire object, it is deleted when no reader can access it
+    void retire(void *ptr, void (*deleter)(void *)) {
+        {
+            std::lock_guard _(_mx);
+            std::uint64_t e = _epoch.fetch_add(1, std::memory_order_seq_cst);
+            _retired.push_back({ptr, deleter, e});
+        }
+        scan();
+    }
+
+    ///Returns future resolved when readers active now leave their read sections
+    future<void> synchronize() {
+        return [&](auto promise) {
+            {
+                std::lock_guard _(_mx);
+                std::uint64_t e = _epoch.fetch_add(1, std::memory_order_seq_cst);
+                _waiters.push_back({std::move(promise), e});
+                _nwaiters.fetch_add(1, std::memory_order_seq_cst);
+            }
+            //readers which left before they could see the waiter are seen by this scan
+            scan();
+        };
+    }
+
+protected:
+
+    struct alignas(64) record {
+        std::atomic<std::uint64_t> _epoch = 0;
+        //nesting of read sections, accessed only by the owner
+        unsigned int _nest = 0;
+        bool _used = true;
+    };
+
+    struct retired {
+        void *_ptr;
+        void (*_deleter)(void *);
+        std::uint64_t _epoch;
+    };
+
+    struct waiter {
+        promise<void> _promise;
+        std::uint64_t _epoch;
+    };
+
+    //registration of the thread, record is released on thread exit
+    struct local_reg {
+        record *rec = nullptr;
+        ~local_reg() {
+            if (rec) instance().release(rec);
+        }
+    };
+
+    std::atomic<std::uint64_t> _epoch = 1;
+    //count of waiters, readers check it when they leave the read section
+    std::atomic<std::size_t> _nwaiters = 0;
+    //a scan has been handed off to a thread pool and it has not started yet
+    std::atomic<bool> _scan_requested = false;
+    std::mutex _mx;
+    std::deque<record> _records;
+    std::vector<retired> _retired;
+    std::vector<waiter> _waiters;
+    static thread_local local_reg _local;
+
+    record *local_record() {
+        record *r = _local.rec;
+        if (r) [[likely]] return r;
+        std::lock_guard _(_mx);
+        auto iter = std::find_if(_records.begin(), _records.end(), [](const record &x){return !x._used;});
+        if (iter != _records.end()) {
+            iter->_used = true;
+            r = &(*iter);
+        } else {
+            r = &_records.emplace_back();
+        }
+        _local.rec = r;
+        return r;
+    }
+
+    void release(record *r) {
+        std::lock_guard _(_mx);
+        r->_used = false;
+    }
+
+    //called by reader, the scan is not performed here
+    void request_scan() {
+        if (_scan_requested.exchange(true, std::memory_order_relaxed)) return;
+        //not a worker, the scan is performed by next retire() or synchronize()
+        if (!thread_pool::current::run_detached([this]{scan();})) {
+            _scan_requested.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    void scan() {
+        //readers leaving from now request new scan
+        _scan_requested.store(false, std::memory_order_relaxed);
+        std::vector<retired> free_list;
+        std::vector<waiter> ready;
+        {
+            std::lock_guard _(_mx);
+            if (_retired.empty() && _waiters.empty()) return;
+            std::uint64_t min = _epoch.load(std::memory_order_seq_cst);
+            for (const auto &r: _records) {
+                std::uint64_t e = r._epoch.load(std::memory_order_seq_cst);
+                if (e && e < min) min = e;
+            }
+            auto p1 = std::partition(_retired.begin(), _retired.end(), [&](const retired &x){
+                return x._epoch >= min;
+            });
+            std::move(p1, _retired.end(), std::back_inserter(free_list));
+            _retired.erase(p1, _retired.end());
+            auto p2 = std::partition(_waiters.begin(), _waiters.end(), [&](const waiter &x){
+                return x._epoch >= min;
+            });
+            std::move(p2, _waiters.end(), std::back_inserter(ready));
+            _waiters.erase(p2, _waiters.end());
+            _nwaiters.fetch_sub(ready.size(), std::memory_order_relaxed);
+        }
+        for (auto &x: free_list) x._deleter(x._ptr);
+        for (auto &x: ready) x._promise();
+    }
+};
+
+inline thread_local ebr_domain::local_reg ebr_domain::_local;
+
+}
+
+///Shared snapshot of read-mostly data (RCU)
+/**
+ * Readers access current snapshot without locking and without modifying shared
+ * reference counters. Reading costs two stores to thread local record and one
+ * fence. The writer publishes a new snapshot by swapping a pointer. Old snapshots are
+ * deleted in publish() or synchronize(), once all readers which could see them left
+ * their read sections. Readers never run destructors or resume writers.
+ *
+ * @code
+ * cocls::shared_snapshot<routing_table> routes(load_routes());
+ *
+ * //reader
+ * {
+ *      auto r = routes.read();
+ *      forward(r->lookup(addr));
+ * }
+ *
+ * //writer
+ * routes.publish(load_routes());
+ * co_await routes.synchronize(); //old table is no longer in use
+ * @endcode
+ *
+ * @tparam T type of data
+ *
+ * @note Reader must not co_await while it holds the reader object, because the coroutine
+ * can continue in other thread.
+ */
+template<typename T>
+class shared_snapshot {
+public:
+
+    ///Read access to the current snapshot
+    class reader {
+    public:
+        reader(const reader &) = delete;
+        reader &operator=(const reader &) = delete;
+        reader(reader &&other):_ptr(std::exchange(other._ptr, nullptr)) {}
+        ~reader() {
+            if (_ptr) _details::ebr_domain::instance().unpin();
+        }
+
+        const T &operator*() const {return *_ptr;}
+        const T *operator->() const {return _ptr;}
+
+    protected:
+        explicit reader(const T *ptr):_ptr(ptr) {}
+        const T *_ptr;
+
+        friend class shared_snapshot;
+    };
+
+    ///Construct with initial value
+    template<typename ... Args>
+    explicit shared_snapshot(Args && ... args)
+        :_ptr(new T(std::forward<Args>(args)...)) {}
+
+    shared_snapshot(const shared_snapshot &) = delete;
+    shared_snapshot &operator=(const shared_snapshot &) = delete;
+
+    ///Destroy snapshot. There must be no readers
+    ~shared_snapshot() {
+        delete _ptr.load(std::memory_order_relaxed);
+    }
+
+    ///Enter read section and access current snapshot
+    /**
+     * @return reader object. The snapshot is valid until the reader is destroyed
+     */
+    reader read() const {
+        auto &d = _details::ebr_domain::instance();
+        d.pin();
+        return reader(_ptr.load(std::memory_order_seq_cst));
+    }
+
+    ///Publish new snapshot
+    /**
+     * @param value new value. Old value is deleted when it is no longer read
+     */
+    void publish(T value) {
+        publish(std::make_unique<T>(std::move(value)));
+    }
+
+    ///Publish new snapshot
+    void publish(std::unique_ptr<T> value) {
+        T *old = _ptr.exchange(value.release(), std::memory_order_seq_cst);
+        _details::ebr_domain::instance().retire(old, [](void *p){delete static_cast<T *>(p);});
+    }
+
+    ///Copy current snapshot, modify the copy and publish it
+    /**
+     * @param fn function which receives reference to the copy. Updates are serialized.
+     */
+    template<typename Fn>
+    void update(Fn &&fn) {
+        std::lock_guard _(_write_mx);
+        auto cpy = std::make_unique<T>(*_ptr.load(std::memory_order_acquire));
+        fn(*cpy);
+        publish(std::move(cpy));
+    }
+
+    ///Wait until all readers which could see previous snapshots are gone
+    /**
+     * @return future, which is resolved when the last such reader leaves its
+     * read section. The waiting doesn't block a thread. The future is resolved in the
+     * thread pool of a reader, at the latest when the thread of that reader enters next
+     * read section. If readers are not workers of a thread pool, the future is resolved by
+     * next publish() or synchronize()
+     */
+    future<void> synchronize() {
+        return _details::ebr_domain::instance().synchronize();
+    }
+
+protected:
+    std::atomic<T *> _ptr;
+    std::mutex _write_mx;
+};
+
+}
+
+#endif /* SRC_COCLASSES_SHARED_SNAPSHOT_H_ */
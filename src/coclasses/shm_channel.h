@@ -0,0 +1,492 @@
+/**
+ * @file shm_channel.h
+ *
+ * Inter-process channel over shared memory (Linux only)
+ */
+#pragma once
+#ifndef SRC_COCLASSES_SHM_CHANNEL_H_
+#define SRC_COCLASSES_SHM_CHANNEL_H_
+
+#include "future.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <climits>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace cocls {
+
+///Exception:
+/**
+ * Thrown when shared memory doesn't contain a channel, or the channel was created for
+ * different type of item
+ */
+class shm_channel_mismatch_exception: public std::exception {
+public:
+    const char *what() const noexcept override {
+        return "Shared memory doesn't contain compatible shm_channel";
+    }
+};
+
+///Inter-process channel - single producer, single consumer ring buffer in shared memory
+/**
+ * The ring buffer is placed in a shared memory created by shm_open() (named channel) or
+ * memfd_create() (anonymous channel, the descriptor can be inherited by fork() or passed
+ * through an unix socket).
+ *
+ * The fast path of push() and pop() doesn't involve any syscall nor lock. It only moves
+ * indexes in the ring and checks, whether the other side is parked. The side is parked
+ * only when the ring is full (producer) or empty (consumer). Parking is done by an internal
+ * helper thread, which spins for a while and then sleeps on a futex placed in shared memory.
+ * The other side wakes the futex only if the parked flag is set. Awaiting coroutine is
+ * then resumed in the helper thread.
+ *
+ * Only one process (and one coroutine at time) can push and only one process can pop.
+ * Every push() and pop() must be awaited (or its future must be resolved) before the
+ * next call.
+ *
+ * @code
+ * auto ch = cocls::shm_channel<int>::create_anonymous(1024);
+ * if (fork() == 0) {
+ *      auto rd = cocls::shm_channel<int>::attach(ch.fd());
+ *      int v = rd.pop().wait();
+ *      ...
+ * }
+ * co_await ch.push(42);
+ * @endcode
+ *
+ * @tparam T type of item. It must be trivially copyable and must not contain pointers
+ *
+ * @note when the channel is inherited by fork(), the child process must attach own
+ * channel object (attach(fd)). The inherited object can't be used in the child
+ */
+template<typename T>
+class shm_channel {
+public:
+
+    static_assert(std::is_trivially_copyable_v<T>, "Item must be trivially copyable");
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "Requires lock-free 64bit atomics");
+
+    static constexpr std::size_t cache_line = 64;
+    ///count of checks performed by the helper thread before it sleeps on the futex
+    /** Spinning is disabled on single CPU machine, where it only delays the other side */
+    static constexpr unsigned int spin_count = 2000;
+
+    ///Construct empty channel object
+    shm_channel() = default;
+
+    ///Create named channel
+    /**
+     * @param name name of the shared memory (see shm_open), for example "/mychannel"
+     * @param capacity capacity of the ring, rounded up to power of two
+     * @return channel
+     * @exception std::system_error failed to create the shared memory (also if it already exists)
+     */
+    static shm_channel create(const std::string &name, std::size_t capacity) {
+        int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (fd < 0) throw std::system_error(errno, std::system_category(), "shm_open");
+        return shm_channel(std::make_unique<state>(fd, capacity));
+    }
+
+    ///Open named channel created by other process
+    /**
+     * @param name name of the shared memory
+     * @return channel
+     * @exception std::system_error failed to open the shared memory
+     * @exception shm_channel_mismatch_exception not a channel, or different type of item
+     */
+    static shm_channel open(const std::string &name) {
+        int fd = ::shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0600);
+        if (fd < 0) throw std::system_error(errno, std::system_category(), "shm_open");
+        return shm_channel(std::make_unique<state>(fd));
+    }
+
+    ///Remove name of the channel
+    /**
+     * Opened channels are not affected
+     * @param name name of the shared memory
+     */
+    static void unlink(const std::string &name) {
+        ::shm_unlink(name.c_str());
+    }
+
+    ///Create anonymous channel
+    /**
+     * @param capacity capacity of the ring, rounded up to power of two
+     * @return channel. Use fd() to pass the channel to other process
+     * @exception std::system_error failed to create the shared memory
+     */
+    static shm_channel create_anonymous(std::size_t capacity) {
+        int fd = ::memfd_create("cocls_shm_channel", 0);
+        if (fd < 0) throw std::system_error(errno, std::system_category(), "memfd_create");
+        return shm_channel(std::make_unique<state>(fd, capacity));
+    }
+
+    ///Attach channel by file descriptor
+    /**
+     * @param fd descriptor of the shared memory. The function duplicates the descriptor
+     * @return channel
+     * @exception std::system_error failed to map the shared memory
+     * @exception shm_channel_mismatch_exception not a channel, or different type of item
+     */
+    static shm_channel attach(int fd) {
+        int d = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (d < 0) throw std::system_error(errno, std::system_category(), "fcntl");
+        return shm_channel(std::make_unique<state>(d));
+    }
+
+    ///Returns descriptor of the shared memory
+    int fd() const {return _state->_fd;}
+
+    ///Returns true if the channel is initialized
+    bool valid() const {return _state != nullptr;}
+
+    ///Push item (producer)
+    /**
+     * @param v item
+     * @return future, which is resolved, when the item is in the ring. If there is
+     * a space in the ring, the future is already resolved
+     */
+    future<void> push(const T &v) {
+        return [&](auto promise) {
+            if (_state->try_push(v)) {
+                promise();
+            } else {
+                _state->_push_helper.post(_state.get(), push_op{v, std::move(promise)});
+            }
+        };
+    }
+
+    ///Pop item (consumer)
+    /**
+     * @return future with the item. If the ring is not empty, the future is already
+     * resolved. If the channel is closed and empty, the future throws await_canceled_exception
+     */
+    future<T> pop() {
+        return [&](auto promise) {
+            pop_op op{std::move(promise)};
+            if (!op(_state.get())) {
+                _state->_pop_helper.post(_state.get(), std::move(op));
+            }
+        };
+    }
+
+    ///Try to push item without waiting (producer)
+    /**
+     * @param v item
+     * @retval true pushed
+     * @retval false ring is full
+     */
+    bool try_push(const T &v) {
+        return _state->try_push(v);
+    }
+
+    ///Try to pop item without waiting (consumer)
+    /**
+     * @return item or no value if the ring is empty
+     */
+    std::optional<T> try_pop() {
+        T v;
+        if (_state->try_pop(v)) return v;
+        return {};
+    }
+
+    ///Close the channel (producer)
+    /**
+     * Consumer can read remaining items, then pop() throws await_canceled_exception
+     */
+    void close() {
+        _state->close();
+    }
+
+    ///Returns true if the channel was closed by the producer
+    bool closed() const {
+        return _state->closed();
+    }
+
+protected:
+
+    struct header {
+        std::atomic<std::uint64_t> _magic;
+        std::uint64_t _capacity;
+        std::uint64_t _item_size;
+        //written by consumer
+        alignas(cache_line) std::atomic<std::uint64_t> _head;
+        std::atomic<std::uint32_t> _space_seq;
+        std::atomic<std::uint32_t> _consumer_parked;
+        //written by producer
+        alignas(cache_line) std::atomic<std::uint64_t> _tail;
+        std::atomic<std::uint32_t> _data_seq;
+        std::atomic<std::uint32_t> _producer_parked;
+        std::atomic<std::uint32_t> _closed;
+    };
+
+    static constexpr std::uint64_t magic = 0x4C4E4843534C4F43ULL;
+
+    struct state;
+
+    ///Helper thread, which parks one side of the channel
+    template<typename Op>
+    class helper {
+    public:
+        void post(state *st, Op &&op) {
+            std::lock_guard _(_mx);
+            _op.emplace(std::move(op));
+            if (!_thr.joinable()) _thr = std::thread([this, st]{worker(st);});
+            _cond.notify_one();
+        }
+
+        void stop(state *st) {
+            if (!_thr.joinable()) return;
+            {
+                std::lock_guard _(_mx);
+                _stop.store(true, std::memory_order_relaxed);
+                _cond.notify_one();
+            }
+            Op::wake(st);
+            _thr.join();
+        }
+
+    protected:
+        std::mutex _mx;
+        std::condition_variable _cond;
+        std::optional<Op> _op;
+        std::atomic<bool> _stop = false;
+        std::thread _thr;
+
+        void worker(state *st) {
+            std::unique_lock lk(_mx);
+            for(;;) {
+                _cond.wait(lk, [&]{return _op.has_value() || _stop.load(std::memory_order_relaxed);});
+                if (_stop.load(std::memory_order_relaxed)) break;
+                Op op = std::move(*_op);
+                _op.reset();
+                lk.unlock();
+                while (!op(st)) {
+                    if (_stop.load(std::memory_order_relaxed)) return;
+                    op.park(st, _stop);
+                }
+                lk.lock();
+            }
+        }
+    };
+
+    struct push_op {
+        T _value;
+        promise<void> _promise;
+        bool operator()(state *st) {
+            if (!st->try_push(_value)) return false;
+            _promise();
+            return true;
+        }
+        static void park(state *st, const std::atomic<bool> &stop) {
+            st->park(st->_hdr->_space_seq, st->_hdr->_producer_parked, stop, [st]{
+                return !st->full();
+            });
+        }
+        static void wake(state *st) {
+            st->wake_all(st->_hdr->_space_seq);
+        }
+    };
+
+    struct pop_op {
+        promise<T> _promise;
+        bool operator()(state *st) {
+            T v;
+            if (st->try_pop(v)) {
+                _promise(std::move(v));
+                return true;
+            }
+            if (st->closed()) {
+                //items pushed before close must be delivered
+                if (st->try_pop(v)) _promise(std::move(v));
+                else _promise(std::make_exception_ptr(await_canceled_exception()));
+                return true;
+            }
+            return false;
+        }
+        static void park(state *st, const std::atomic<bool> &stop) {
+            st->park(st->_hdr->_data_seq, st->_hdr->_consumer_parked, stop, [st]{
+                return !st->empty() || st->closed();
+            });
+        }
+        static void wake(state *st) {
+            st->wake_all(st->_hdr->_data_seq);
+        }
+    };
+
+    struct state {
+        header *_hdr = nullptr;
+        T *_items = nullptr;
+        std::uint64_t _mask = 0;
+        std::size_t _map_size = 0;
+        int _fd = -1;
+        //producer's local copy of head
+        alignas(cache_line) std::uint64_t _head_cache = 0;
+        //consumer's local copy of tail
+        alignas(cache_line) std::uint64_t _tail_cache = 0;
+        helper<push_op> _push_helper;
+        helper<pop_op> _pop_helper;
+
+        //create new channel
+        state(int fd, std::size_t capacity):_fd(fd) {
+            std::uint64_t cap = 1;
+            while (cap < capacity) cap <<= 1;
+            _map_size = sizeof(header) + cap * sizeof(T);
+            if (::ftruncate(_fd, _map_size) < 0) fail("ftruncate");
+            map();
+            new(_hdr) header{};
+            _hdr->_capacity = cap;
+            _hdr->_item_size = sizeof(T);
+            _hdr->_magic.store(magic, std::memory_order_release);
+            init();
+        }
+
+        //attach existing channel
+        explicit state(int fd):_fd(fd) {
+            struct stat st;
+            if (::fstat(_fd, &st) < 0) fail("fstat");
+            _map_size = st.st_size;
+            if (_map_size < sizeof(header)) {
+                ::close(_fd);
+                throw shm_channel_mismatch_exception();
+            }
+            map();
+            if (_hdr->_magic.load(std::memory_order_acquire) != magic
+                    || _hdr->_item_size != sizeof(T)
+                    || _map_size < sizeof(header) + _hdr->_capacity * sizeof(T)) {
+                ::munmap(_hdr, _map_size);
+                ::close(_fd);
+                throw shm_channel_mismatch_exception();
+            }
+            init();
+        }
+
+        state(const state &) = delete;
+        state &operator=(const state &) = delete;
+
+        ~state() {
+            _push_helper.stop(this);
+            _pop_helper.stop(this);
+            ::munmap(_hdr, _map_size);
+            ::close(_fd);
+        }
+
+        void fail(const char *fn) {
+            int e = errno;
+            ::close(_fd);
+            throw std::system_error(e, std::system_category(), fn);
+        }
+
+        void map() {
+            void *p = ::mmap(nullptr, _map_size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+            if (p == MAP_FAILED) fail("mmap");
+            _hdr = static_cast<header *>(p);
+        }
+
+        void init() {
+            _items = reinterpret_cast<T *>(reinterpret_cast<char *>(_hdr) + sizeof(header));
+            _mask = _hdr->_capacity - 1;
+            _head_cache = _hdr->_head.load(std::memory_order_acquire);
+            _tail_cache = _hdr->_tail.load(std::memory_order_acquire);
+        }
+
+        bool try_push(const T &v) {
+            std::uint64_t t = _hdr->_tail.load(std::memory_order_relaxed);
+            if (t - _head_cache > _mask) {
+                _head_cache = _hdr->_head.load(std::memory_order_acquire);
+                if (t - _head_cache > _mask) return false;
+            }
+            _items[t & _mask] = v;
+            _hdr->_tail.store(t + 1, std::memory_order_release);
+            wake_other(_hdr->_data_seq, _hdr->_consumer_parked);
+            return true;
+        }
+
+        bool try_pop(T &v) {
+            std::uint64_t h = _hdr->_head.load(std::memory_order_relaxed);
+            if (h == _tail_cache) {
+                _tail_cache = _hdr->_tail.load(std::memory_order_acquire);
+                if (h == _tail_cache) return false;
+            }
+            v = _items[h & _mask];
+            _hdr->_head.store(h + 1, std::memory_order_release);
+            wake_other(_hdr->_space_seq, _hdr->_producer_parked);
+            return true;
+        }
+
+        bool full() const {
+            return _hdr->_tail.load(std::memory_order_relaxed) - _hdr->_head.load(std::memory_order_acquire) > _mask;
+        }
+
+        bool empty() const {
+            return _hdr->_head.load(std::memory_order_relaxed) == _hdr->_tail.load(std::memory_order_acquire);
+        }
+
+        bool closed() const {
+            return _hdr->_closed.load(std::memory_order_acquire) != 0;
+        }
+
+        void close() {
+            _hdr->_closed.store(1, std::memory_order_release);
+            wake_other(_hdr->_data_seq, _hdr->_consumer_parked);
+        }
+
+        //wake other side, if it is parked (pairs with fence in park())
+        static void wake_other(std::atomic<std::uint32_t> &seq, std::atomic<std::uint32_t> &parked) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (parked.load(std::memory_order_relaxed)) [[unlikely]] {
+                seq.fetch_add(1, std::memory_order_release);
+                futex(seq, FUTEX_WAKE, 1);
+            }
+        }
+
+        static void wake_all(std::atomic<std::uint32_t> &seq) {
+            seq.fetch_add(1, std::memory_order_release);
+            futex(seq, FUTEX_WAKE, INT_MAX);
+        }
+
+        template<typename Pred>
+        void park(std::atomic<std::uint32_t> &seq, std::atomic<std::uint32_t> &parked,
+                const std::atomic<bool> &stop, Pred &&ready) {
+            static const unsigned int spins = std::thread::hardware_concurrency() > 1?spin_count:0;
+            for (unsigned int i = 0; i < spins; i++) {
+                if (ready()) return;
+            }
+            std::uint32_t s = seq.load(std::memory_order_acquire);
+            parked.store(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!ready() && !stop.load(std::memory_order_relaxed)) {
+                futex(seq, FUTEX_WAIT, s);
+            }
+            parked.store(0, std::memory_order_relaxed);
+        }
+
+        static void futex(std::atomic<std::uint32_t> &word, int op, std::uint32_t val) {
+            static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t));
+            ::syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&word), op, val, nullptr, nullptr, 0);
+        }
+    };
+
+    std::unique_ptr<state> _state;
+
+    explicit shm_channel(std::unique_ptr<state> &&st):_state(std::move(st)) {}
+};
+
+}
+
+#endif /* SRC_COCLASSES_SHM_CHANNEL_H_ */
@@ -0,0 +1,88 @@
+/**
+ * @file spsc_ring.h
+ *
+ * Bounded lock-free ring buffer (single producer, single consumer)
+ */
+#pragma once
+#ifndef SRC_COCLASSES_SPSC_RING_H_
+#define SRC_COCLASSES_SPSC_RING_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace cocls {
+
+///Bounded lock-free ring buffer for exactly one producer and one consumer
+/**
+ * Producer's and consumer's indexes are placed on separate cache lines. Each side keeps
+ * a private copy of the other side's index and refreshes it only when the ring looks full
+ * (or empty), so in steady state each side writes only own cache line.
+ *
+ * @tparam T type of item, should be trivially copyable (pointers)
+ * @tparam N capacity, must be power of two
+ */
+template<typename T, std::size_t N>
+class spsc_ring {
+public:
+
+    static_assert(N > 0 && (N & (N - 1)) == 0, "Capacity must be power of two");
+
+    static constexpr std::size_t cache_line = 64;
+
+    spsc_ring() = default;
+    spsc_ring(const spsc_ring &) = delete;
+    spsc_ring &operator=(const spsc_ring &) = delete;
+
+    ///push item (producer only)
+    /**
+     * @param v item
+     * @retval true pushed
+     * @retval false ring is full
+     */
+    bool push(const T &v) {
+        std::size_t t = _tail.load(std::memory_order_relaxed);
+        if (t - _head_cache == N) [[unlikely]] {
+            _head_cache = _head.load(std::memory_order_acquire);
+            if (t - _head_cache == N) return false;
+        }
+        _items[t & (N - 1)] = v;
+        _tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    ///pop item (consumer only)
+    /**
+     * @param v receives the item
+     * @retval true item popped
+     * @retval false ring is empty
+     */
+    bool pop(T &v) {
+        std::size_t h = _head.load(std::memory_order_relaxed);
+        if (h == _tail_cache) {
+            _tail_cache = _tail.load(std::memory_order_acquire);
+            if (h == _tail_cache) return false;
+        }
+        v = _items[h & (N - 1)];
+        _head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    ///returns true if the ring is empty (consumer only)
+    bool empty() const {
+        return _head.load(std::memory_order_relaxed) == _tail.load(std::memory_order_acquire);
+    }
+
+protected:
+    //written by consumer
+    alignas(cache_line) std::atomic<std::size_t> _head = 0;
+    std::size_t _tail_cache = 0;
+    //written by producer
+    alignas(cache_line) std::atomic<std::size_t> _tail = 0;
+    std::size_t _head_cache = 0;
+    alignas(cache_line) std::array<T, N> _items;
+};
+
+}
+
+#endif /* SRC_COCLASSES_SPSC_RING_H_ */
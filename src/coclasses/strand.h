@@ -0,0 +1,284 @@
+/**
+ * @file strand.h
+ *
+ * Strand - serial executor on top of the thread pool
+ */
+#pragma once
+#ifndef SRC_COCLASSES_STRAND_H_
+#define SRC_COCLASSES_STRAND_H_
+
+#include "mpsc_queue.h"
+#include "thread_pool.h"
+
+#include <memory>
+
+namespace cocls {
+
+///Strand - serial executor
+/**
+ * Work posted to the strand is executed one at a time in FIFO order, but on any worker of
+ * the thread pool. This allows to protect state of an object without a mutex. Coroutines
+ * can enter the strand by co_await, or they can use resumption_policy::strand, which
+ * causes, that coroutine is always resumed in the strand.
+ *
+ * Submission is lock-free. There is at most one scheduled drain for the strand. The
+ * drain runs multiple items in one pool's slot (up to max_batch), then it reschedules itself
+ * to give a chance to other work enqueued in the thread pool.
+ *
+ * The strand object is a reference to shared state, it can be copied. All copies
+ * refer to the same strand. The thread pool must outlive the strand.
+ *
+ * @code
+ * cocls::strand str(pool);
+ * str.run_detached([&]{ ++counter;});
+ *
+ * cocls::task<> coro(cocls::strand str) {
+ *      co_await str;
+ *      //running in strand
+ *      ++counter;
+ * }
+ * @endcode
+ */
+class strand {
+protected:
+    class state;
+public:
+
+    ///Construct empty strand object
+    /** You can assign the strand later */
+    strand() = default;
+
+    ///Construct strand
+    /**
+     * @param pool thread pool where items are executed
+     * @param max_batch maximum count of items executed in single drain
+     */
+    strand(thread_pool &pool, unsigned int max_batch = 64)
+        :_state(std::make_shared<state>(pool, max_batch)) {}
+
+    ///Run function in the strand
+    /**
+     * @param fn function to run. Function returns immediately
+     */
+    template<typename Fn>
+    CXX20_REQUIRES(std::same_as<void, decltype(std::declval<Fn>()())>)
+    void run_detached(Fn &&fn) {
+        _state->push(new fn_item<std::decay_t<Fn> >(std::forward<Fn>(fn)));
+    }
+
+    ///Run function in the strand, returns future
+    /**
+     * @param fn function to run
+     * @return future<Ret> where Ret is return value of the function
+     */
+    template<typename Fn>
+    auto run(Fn &&fn) -> future<decltype(std::declval<Fn>()())> {
+        using RetVal = decltype(std::declval<Fn>()());
+        return [&](auto promise) {
+            run_detached([fn = std::tuple<Fn>(std::forward<Fn>(fn)), promise = std::move(promise)]() mutable {
+                try {
+                    if constexpr(std::is_void_v<RetVal>) {
+                        std::get<0>(fn)();
+                        promise();
+                    } else {
+                        promise(std::get<0>(fn)());
+                    }
+                } catch(...) {
+                    promise(std::current_exception());
+                }
+            });
+        };
+    }
+
+    ///Awaiter, transfers coroutine to the strand
+    class co_awaiter: public abstract_awaiter {
+    public:
+        co_awaiter(const strand &owner):_owner(owner._state.get()) {}
+        co_awaiter(const co_awaiter &) = default;
+        co_awaiter &operator=(const co_awaiter &) = delete;
+
+        static constexpr bool await_ready() noexcept {return false;}
+        void await_suspend(std::coroutine_handle<> h) {
+            _h = h;
+            _owner->push(this);
+        }
+        static constexpr void await_resume() noexcept {}
+
+        virtual void resume() noexcept override {
+            _h.resume();
+        }
+
+    protected:
+        state *_owner;
+        std::coroutine_handle<> _h;
+    };
+
+    ///Transfer coroutine to the strand
+    /**
+     * @code
+     * co_await str;
+     * //now coroutine runs in the strand
+     * @endcode
+     */
+    co_awaiter operator co_await() {
+        return *this;
+    }
+
+    ///Enqueue item to the strand
+    /**
+     * @param item item to enqueue. The item is resumed in the strand. The resume()
+     * function must perform the work synchronously
+     */
+    void push(abstract_awaiter *item) {
+        _state->push(item);
+    }
+
+    ///Returns true if the strand is initialized
+    bool valid() const {return _state != nullptr;}
+
+    ///Returns true if current thread is running the strand
+    friend bool is_current(const strand &s) {
+        return s._state != nullptr && state::_current == s._state.get();
+    }
+
+protected:
+
+    class state: public std::enable_shared_from_this<state> {
+    public:
+        state(thread_pool &pool, unsigned int max_batch)
+            :_pool(pool),_max_batch(max_batch?max_batch:1) {}
+
+        void push(abstract_awaiter *item) {
+            if (_queue.push(item)) schedule();
+        }
+
+        static thread_local state *_current;
+
+    protected:
+        thread_pool &_pool;
+        unsigned int _max_batch;
+        mpsc_queue _queue;
+
+        void schedule() {
+            _pool.run_detached([me = this->shared_from_this()]{
+                me->drain();
+            });
+        }
+
+        void drain() {
+            auto prev = std::exchange(_current, this);
+            unsigned int cnt = _max_batch;
+            for(;;) {
+                abstract_awaiter *x = _queue.pop();
+                if (!x) {
+                    if (_queue.try_idle()) break;
+                    continue;
+                }
+                x->resume();
+                if (--cnt == 0) {
+                    //batch is full, reschedule and give chance to others
+                    _current = prev;
+                    schedule();
+                    return;
+                }
+            }
+            _current = prev;
+        }
+    };
+
+    template<typename Fn>
+    class fn_item: public abstract_awaiter {
+    public:
+        template<typename X>
+        fn_item(X &&fn):_fn(std::forward<X>(fn)) {}
+        virtual void resume() noexcept override {
+            _fn();
+            delete this;
+        }
+    protected:
+        Fn _fn;
+    };
+
+    std::shared_ptr<state> _state;
+
+};
+
+inline thread_local strand::state *strand::state::_current = nullptr;
+
+namespace resumption_policy {
+
+///Resumption policy - resume coroutine in the strand
+/**
+ * The policy must be initialized by a strand (task<>::initialize_policy(strand)). Coroutine
+ * is not started until the policy is initialized. Coroutine always runs in the strand.
+ */
+struct strand {
+
+    ///Node used to enqueue the coroutine to the strand
+    struct node: public abstract_awaiter {
+        std::coroutine_handle<> _h;
+        node() = default;
+        node(const node &):abstract_awaiter() {}
+        virtual void resume() noexcept override {
+            _h.resume();
+        }
+    };
+
+    ::cocls::strand _strand;
+    node _node;
+
+    strand() = default;
+    strand(const ::cocls::strand &s):_strand(s) {}
+
+    bool is_policy_ready() const noexcept {
+        return _strand.valid();
+    }
+
+    struct initial_awaiter {
+        strand &_p;
+        initial_awaiter(strand &p):_p(p) {}
+        static constexpr bool await_ready() noexcept {return false;}
+        void await_suspend(std::coroutine_handle<> h) {
+            if (_p.is_policy_ready()) _p.resume(h);
+        }
+        static constexpr void await_resume() noexcept {}
+    };
+
+    void resume(std::coroutine_handle<> h) {
+        _node._h = h;
+        _strand.push(&_node);
+    }
+
+    std::coroutine_handle<> resume_handle(std::coroutine_handle<> h) noexcept {
+        //we are in the strand, so we can transfer directly
+        if (is_current(_strand)) return h;
+        resume(h);
+        return std::noop_coroutine();
+    }
+
+    ///Initializes policy
+    /**
+     * @param s strand
+     * @retval true you need to resume coroutine
+     * @retval false you don't need to resume coroutine
+     */
+    bool initialize_policy(::cocls::strand s) {
+        bool ret = !_strand.valid();
+        _strand = std::move(s);
+        return ret;
+    }
+
+    std::coroutine_handle<> resume_handle_next() noexcept {
+        return resumption_policy::queued::resume_handle_next();
+    }
+
+    static bool can_block() {
+        return !cocls::thread_pool::current::any_enqueued();
+    }
+};
+
+}
+
+}
+
+#endif /* SRC_COCLASSES_STRAND_H_ */
@@ -0,0 +1,691 @@
+/**
+ * @file thread_per_core.h
+ *
+ * Thread-per-core shared-nothing runtime (Linux only)
+ */
+#pragma once
+#ifndef SRC_COCLASSES_THREAD_PER_CORE_H_
+#define SRC_COCLASSES_THREAD_PER_CORE_H_
+
+#include "awaiter.h"
+#include "mpsc_queue.h"
+#include "priority_queue.h"
+#include "queued_resumption_policy.h"
+#include "spsc_ring.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace cocls {
+
+///Exception:
+/**
+ * Thrown when a function which needs the current core is called outside of
+ * thread_per_core's thread
+ */
+class not_on_core_exception: public std::exception {
+public:
+    const char *what() const noexcept override {
+        return "Current thread is not a core of thread_per_core runtime";
+    }
+};
+
+///Thread-per-core shared-nothing runtime
+/**
+ * The runtime starts one thread per core and pins it to the CPU. Every core owns
+ *
+ * - run queue (intrusive FIFO of awaiters, dispatcher-style)
+ * - timer heap - see sleep_for(), sleep_until()
+ * - I/O reactor (epoll) - see wait_io()
+ * - poolalloc cache - coroutine frames are allocated from the thread-local cache of the core's
+ *   thread
+ *
+ * None of these structures is ever touched by other threads, so no lock is needed. Cores
+ * communicate only through SPSC rings, there is one ring for every pair of cores. A coroutine
+ * moves to other core by co_await on_core(n). The ring is written only by the source core
+ * and read only by the target core.
+ *
+ * The target core is woken up through eventfd only when it sleeps in epoll_wait(). A busy
+ * core reads own rings without any syscall. Wakeups are collected during one loop iteration
+ * and sent together.
+ *
+ * Threads which don't belong to the runtime (for example main()) submit work through a
+ * lock-free mpsc_queue of the target core.
+ *
+ * @code
+ * cocls::thread_per_core rt(4);
+ *
+ * cocls::task<> coro(cocls::thread_per_core &rt) {
+ *      co_await rt.on_core(0);
+ *      //running on core 0
+ *      co_await cocls::on_core(1);
+ *      //running on core 1
+ * }
+ * @endcode
+ *
+ * @note all coroutines must finish before the runtime is destroyed
+ */
+class thread_per_core {
+public:
+
+    ///capacity of the ring between two cores
+    static constexpr std::size_t ring_size = 256;
+    static constexpr std::size_t cache_line = 64;
+    ///maximum events read from epoll at once
+    static constexpr int max_events = 64;
+
+    using clock = std::chrono::steady_clock;
+
+    class core;
+
+    ///Start the runtime
+    /**
+     * @param cores count of cores (threads)
+     * @param pin pin threads to CPUs. Cores are assigned to CPUs allowed for the process
+     * in order. If there are more cores than CPUs, assignment wraps around
+     */
+    explicit thread_per_core(unsigned int cores = std::thread::hardware_concurrency(), bool pin = true)
+    {
+        if (cores == 0) cores = 1;
+        _rings = std::make_unique<ring[]>(cores * cores);
+        _cores.reserve(cores);
+        for (unsigned int i = 0; i < cores; i++) {
+            _cores.push_back(std::make_unique<core>(*this, i, cores));
+        }
+        std::vector<int> cpus;
+        if (pin) cpus = allowed_cpus();
+        for (unsigned int i = 0; i < cores; i++) {
+            _cores[i]->start(cpus.empty()?-1:cpus[i % cpus.size()]);
+        }
+    }
+
+    thread_per_core(const thread_per_core &) = delete;
+    thread_per_core &operator=(const thread_per_core &) = delete;
+
+    ///Stops all cores and joins threads
+    ~thread_per_core() {
+        for (auto &c: _cores) c->stop();
+        for (auto &c: _cores) c->join();
+    }
+
+    ///Returns count of cores
+    unsigned int size() const {
+        return static_cast<unsigned int>(_cores.size());
+    }
+
+    ///Awaiter, transfers coroutine to a core
+    class on_core_awaiter: public abstract_awaiter {
+    public:
+        on_core_awaiter(core *target):_target(target) {}
+        on_core_awaiter(const on_core_awaiter &) = default;
+        on_core_awaiter &operator=(const on_core_awaiter &) = delete;
+
+        bool await_ready() const noexcept {return core::_current == _target;}
+        void await_suspend(std::coroutine_handle<> h) {
+            _h = h;
+            _target->send(this);
+        }
+        static constexpr void await_resume() noexcept {}
+
+        virtual void resume() noexcept override {
+            _h.resume();
+        }
+    protected:
+        core *_target;
+        std::coroutine_handle<> _h;
+    };
+
+    ///Transfer coroutine to the core
+    /**
+     * @param n index of the core
+     * @return awaiter
+     *
+     * @code
+     * co_await rt.on_core(n);
+     * @endcode
+     *
+     * Can be called from any thread. If the coroutine is already running on the core, it
+     * continues without suspension
+     */
+    on_core_awaiter on_core(unsigned int n) {
+        return on_core_awaiter(get_core(n));
+    }
+
+    ///Run function on the core
+    /**
+     * @param n index of the core
+     * @param fn function to run. Function returns immediately
+     */
+    template<typename Fn>
+    CXX20_REQUIRES(std::same_as<void, decltype(std::declval<Fn>()())>)
+    void run_detached(unsigned int n, Fn &&fn) {
+        get_core(n)->send(new fn_item<std::decay_t<Fn> >(std::forward<Fn>(fn)));
+    }
+
+    ///Awaiter, suspends coroutine until given time point
+    class sleep_awaiter: public abstract_awaiter {
+    public:
+        sleep_awaiter(clock::time_point tp):_tp(tp) {}
+        sleep_awaiter(const sleep_awaiter &) = default;
+        sleep_awaiter &operator=(const sleep_awaiter &) = delete;
+
+        bool await_ready() const noexcept {return _tp <= clock::now();}
+        void await_suspend(std::coroutine_handle<> h) {
+            _h = h;
+            core::current_or_throw()->add_timer(_tp, this);
+        }
+        static constexpr void await_resume() noexcept {}
+
+        virtual void resume() noexcept override {
+            _h.resume();
+        }
+    protected:
+        clock::time_point _tp;
+        std::coroutine_handle<> _h;
+    };
+
+    ///Suspend coroutine until given time point
+    /**
+     * @param tp time point
+     * @return awaiter
+     * @exception not_on_core_exception coroutine doesn't run on a core
+     *
+     * @note coroutine is resumed on the same core
+     */
+    static sleep_awaiter sleep_until(clock::time_point tp) {
+        return sleep_awaiter(tp);
+    }
+
+    ///Suspend coroutine for given duration
+    /**
+     * @param dur duration
+     * @return awaiter
+     * @exception not_on_core_exception coroutine doesn't run on a core
+     *
+     * @note coroutine is resumed on the same core
+     */
+    template<typename Dur>
+    static sleep_awaiter sleep_for(const Dur &dur) {
+        return sleep_awaiter(clock::now() + std::chrono::duration_cast<clock::duration>(dur));
+    }
+
+    ///Awaiter, suspends coroutine until a file descriptor is ready
+    class io_awaiter: public abstract_awaiter {
+    public:
+        io_awaiter(int fd, std::uint32_t events):_fd(fd),_events(events) {}
+        io_awaiter(const io_awaiter &) = default;
+        io_awaiter &operator=(const io_awaiter &) = delete;
+
+        static constexpr bool await_ready() noexcept {return false;}
+        void await_suspend(std::coroutine_handle<> h) {
+            _h = h;
+            core::current_or_throw()->add_io(_fd, _events, this);
+        }
+        std::uint32_t await_resume() const noexcept {return _revents;}
+
+        virtual void resume() noexcept override {
+            _h.resume();
+        }
+    protected:
+        int _fd;
+        std::uint32_t _events;
+        std::uint32_t _revents = 0;
+        std::coroutine_handle<> _h;
+        friend class core;
+    };
+
+    ///Suspend coroutine until the file descriptor is ready
+    /**
+     * @param fd file descriptor (socket, pipe, etc)
+     * @param events epoll events to wait for (EPOLLIN, EPOLLOUT, ...)
+     * @return awaiter, which returns epoll events reported for the descriptor
+     * @exception not_on_core_exception coroutine doesn't run on a core
+     * @exception std::system_error failed to register the descriptor
+     *
+     * The descriptor is registered in epoll of current core in one-shot mode. Only one
+     * coroutine can wait on the descriptor at a time
+     */
+    static io_awaiter wait_io(int fd, std::uint32_t events) {
+        return io_awaiter(fd, events);
+    }
+
+    ///Returns runtime of current thread
+    /**
+     * @return pointer to runtime, or nullptr, if current thread is not a core
+     */
+    static thread_per_core *current() {
+        return core::_current?&core::_current->_owner:nullptr;
+    }
+
+    ///Returns index of current core
+    /**
+     * @exception not_on_core_exception current thread is not a core
+     */
+    static unsigned int current_core() {
+        return core::current_or_throw()->_index;
+    }
+
+    ///Retrieve core
+    /**
+     * @param n index of the core
+     * @return pointer to the core
+     * @exception std::out_of_range invalid index
+     */
+    core *get_core(unsigned int n) const {
+        return _cores.at(n).get();
+    }
+
+    ///One core of the runtime (internal)
+    class alignas(cache_line) core {
+    public:
+
+        core(thread_per_core &owner, unsigned int index, unsigned int count)
+            :_index(index),_owner(owner),_outbox(count) {
+            _evfd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (_evfd < 0) throw std::system_error(errno, std::system_category(), "eventfd");
+            _epfd = ::epoll_create1(EPOLL_CLOEXEC);
+            if (_epfd < 0) {
+                int e = errno;
+                ::close(_evfd);
+                throw std::system_error(e, std::system_category(), "epoll_create1");
+            }
+            epoll_event ev = {};
+            ev.events = EPOLLIN;
+            ev.data.ptr = nullptr;
+            ::epoll_ctl(_epfd, EPOLL_CTL_ADD, _evfd, &ev);
+        }
+        core(const core &) = delete;
+        core &operator=(const core &) = delete;
+        ~core() {
+            ::close(_epfd);
+            ::close(_evfd);
+        }
+
+        ///Send item to this core (MT Safe)
+        /**
+         * @param item item to send, it is resumed on this core
+         */
+        void send(abstract_awaiter *item) {
+            core *cur = _current;
+            if (cur == this) {
+                enqueue(item);
+            } else if (cur && &cur->_owner == &_owner) {
+                cur->send_to(*this, item);
+            } else {
+                _foreign.push(item);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                wake_if_sleeping();
+            }
+        }
+
+        ///Returns index of the core
+        unsigned int index() const {return _index;}
+
+        ///Returns true, if current thread is this core
+        bool is_current() const {return _current == this;}
+
+        ///Returns current core or nullptr
+        static core *current() {return _current;}
+
+    protected:
+
+        struct timer {
+            clock::time_point _tp;
+            abstract_awaiter *_item;
+            bool operator>(const timer &other) const {return _tp > other._tp;}
+        };
+
+        ///items waiting for free space in the ring
+        struct outbox {
+            abstract_awaiter *_head = nullptr;
+            abstract_awaiter *_tail = nullptr;
+            bool _signal = false;
+        };
+
+        //---- written by other threads
+        alignas(cache_line) std::atomic<bool> _sleeping = false;
+        std::atomic<bool> _stop = false;
+        alignas(cache_line) mpsc_queue _foreign{true};
+
+        //---- local state
+        alignas(cache_line) unsigned int _index;
+        thread_per_core &_owner;
+        int _epfd = -1;
+        int _evfd = -1;
+        abstract_awaiter *_head = nullptr;
+        abstract_awaiter *_tail = nullptr;
+        priority_queue<timer, std::vector<timer>, std::greater<timer> > _timers;
+        std::vector<outbox> _outbox;
+        bool _outbox_dirty = false;
+        unsigned int _io_waiting = 0;
+        std::thread _thr;
+
+        static thread_local core *_current;
+
+        friend class thread_per_core;
+
+        static core *current_or_throw() {
+            if (_current == nullptr) throw not_on_core_exception();
+            return _current;
+        }
+
+        void start(int cpu) {
+            _thr = std::thread([this, cpu]{run(cpu);});
+        }
+
+        void stop() {
+            _stop.store(true, std::memory_order_relaxed);
+            notify();
+        }
+
+        void join() {
+            if (_thr.joinable()) _thr.join();
+        }
+
+        void notify() {
+            std::uint64_t one = 1;
+            [[maybe_unused]] auto r = ::write(_evfd, &one, sizeof(one));
+        }
+
+        //caller must issue seq_cst fence after the item is published
+        void wake_if_sleeping() {
+            if (_sleeping.load(std::memory_order_relaxed)
+                    && _sleeping.exchange(false, std::memory_order_relaxed)) {
+                notify();
+            }
+        }
+
+        void enqueue(abstract_awaiter *item) {
+            item->_next = nullptr;
+            if (_tail) _tail->_next = item; else _head = item;
+            _tail = item;
+        }
+
+        void send_to(core &target, abstract_awaiter *item) {
+            outbox &ob = _outbox[target._index];
+            if (ob._head || !_owner.get_ring(_index, target._index).push(item)) {
+                //ring is full, keep order
+                item->_next = nullptr;
+                if (ob._tail) ob._tail->_next = item; else ob._head = item;
+                ob._tail = item;
+            }
+            ob._signal = true;
+            _outbox_dirty = true;
+        }
+
+        void flush_outbox() {
+            if (!_outbox_dirty) return;
+            _outbox_dirty = false;
+            for (unsigned int i = 0; i < _outbox.size(); i++) {
+                outbox &ob = _outbox[i];
+                if (ob._head) {
+                    ring &r = _owner.get_ring(_index, i);
+                    while (ob._head) {
+                        abstract_awaiter *n = ob._head->_next;
+                        if (!r.push(ob._head)) break;
+                        ob._head = n;
+                    }
+                    if (!ob._head) ob._tail = nullptr;
+                    else _outbox_dirty = true;
+                }
+            }
+            //pairs with the fence in idle()
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            for (unsigned int i = 0; i < _outbox.size(); i++) {
+                outbox &ob = _outbox[i];
+                if (ob._signal) {
+                    ob._signal = false;
+                    _owner._cores[i]->wake_if_sleeping();
+                }
+            }
+        }
+
+        void collect() {
+            for (unsigned int i = 0; i < _outbox.size(); i++) {
+                if (i == _index) continue;
+                ring &r = _owner.get_ring(i, _index);
+                abstract_awaiter *x;
+                while (r.pop(x)) enqueue(x);
+            }
+            //pop() swaps the head written by submitters, check it by plain load first
+            if (!_foreign.empty()) {
+                while (auto x = _foreign.pop()) enqueue(x);
+            }
+        }
+
+        bool has_incoming() const {
+            if (_stop.load(std::memory_order_relaxed) || !_foreign.empty()) return true;
+            for (unsigned int i = 0; i < _outbox.size(); i++) {
+                if (i != _index && !_owner.get_ring(i, _index).empty()) return true;
+            }
+            return false;
+        }
+
+        void add_timer(clock::time_point tp, abstract_awaiter *item) {
+            _timers.push(timer{tp, item});
+        }
+
+        void fire_timers() {
+            if (_timers.empty()) return;
+            auto now = clock::now();
+            while (!_timers.empty() && _timers.top()._tp <= now) {
+                enqueue(_timers.pop_item()._item);
+            }
+        }
+
+        void add_io(int fd, std::uint32_t events, io_awaiter *item) {
+            epoll_event ev = {};
+            ev.events = events | EPOLLONESHOT;
+            ev.data.ptr = item;
+            if (::epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+                if (errno != EEXIST || ::epoll_ctl(_epfd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+                    throw std::system_error(errno, std::system_category(), "epoll_ctl");
+                }
+            }
+            ++_io_waiting;
+        }
+
+        void poll_io(int timeout) {
+            epoll_event ev[max_events];
+            int r = ::epoll_wait(_epfd, ev, max_events, timeout);
+            for (int i = 0; i < r; i++) {
+                if (ev[i].data.ptr == nullptr) {
+                    std::uint64_t v;
+                    [[maybe_unused]] auto rd = ::read(_evfd, &v, sizeof(v));
+                } else {
+                    io_awaiter *a = static_cast<io_awaiter *>(ev[i].data.ptr);
+                    a->_revents = ev[i].events;
+                    --_io_waiting;
+                    enqueue(a);
+                }
+            }
+        }
+
+        void run_local() {
+            abstract_awaiter *x = std::exchange(_head, nullptr);
+            _tail = nullptr;
+            while (x) {
+                abstract_awaiter *n = x->_next;
+                x->resume();
+                x = n;
+            }
+        }
+
+        void idle() {
+            int timeout = -1;
+            if (_outbox_dirty) {
+                //a ring is full, retry later
+                timeout = 1;
+            } else if (!_timers.empty()) {
+                auto d = _timers.top()._tp - clock::now();
+                if (d <= clock::duration::zero()) return;
+                timeout = static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(d).count());
+            }
+            _sleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!has_incoming()) {
+                poll_io(timeout);
+            }
+            _sleeping.store(false, std::memory_order_relaxed);
+        }
+
+        void run(int cpu) {
+            if (cpu >= 0) {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(cpu, &set);
+                pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            }
+            _current = this;
+            while (!_stop.load(std::memory_order_relaxed)) {
+                collect();
+                if (_io_waiting) poll_io(0);
+                fire_timers();
+                run_local();
+                flush_outbox();
+                if (!_head) idle();
+            }
+            _current = nullptr;
+        }
+    };
+
+protected:
+
+    using ring = spsc_ring<abstract_awaiter *, ring_size>;
+
+    template<typename Fn>
+    class fn_item: public abstract_awaiter {
+    public:
+        template<typename X>
+        fn_item(X &&fn):_fn(std::forward<X>(fn)) {}
+        virtual void resume() noexcept override {
+            _fn();
+            delete this;
+        }
+    protected:
+        Fn _fn;
+    };
+
+    std::vector<std::unique_ptr<core> > _cores;
+    std::unique_ptr<ring[]> _rings;
+
+    ring &get_ring(unsigned int from, unsigned int to) const {
+        return _rings[from * _cores.size() + to];
+    }
+
+    static std::vector<int> allowed_cpus() {
+        std::vector<int> out;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int i = 0; i < CPU_SETSIZE; i++) {
+                if (CPU_ISSET(i, &set)) out.push_back(i);
+            }
+        }
+        return out;
+    }
+};
+
+inline thread_local thread_per_core::core *thread_per_core::core::_current = nullptr;
+
+///Transfer coroutine to other core of current runtime
+/**
+ * @param n index of the core
+ * @return awaiter
+ * @exception not_on_core_exception current thread is not a core. Use thread_per_core::on_core()
+ */
+inline thread_per_core::on_core_awaiter on_core(unsigned int n) {
+    thread_per_core *rt = thread_per_core::current();
+    if (rt == nullptr) throw not_on_core_exception();
+    return rt->on_core(n);
+}
+
+namespace resumption_policy {
+
+///Resumption policy - resume coroutine always on its home core
+/**
+ * Home core is the core, where the coroutine was created. If the coroutine is created
+ * outside of the runtime, the policy must be initialized by
+ * task<>::initialize_policy(runtime, index). Coroutine is not started until the policy
+ * is initialized.
+ */
+struct thread_per_core {
+
+    ///Node used to send the coroutine to the core
+    struct node: public abstract_awaiter {
+        std::coroutine_handle<> _h;
+        node() = default;
+        node(const node &):abstract_awaiter() {}
+        virtual void resume() noexcept override {
+            _h.resume();
+        }
+    };
+
+    ::cocls::thread_per_core::core *_home;
+    node _node;
+
+    thread_per_core():_home(::cocls::thread_per_core::core::current()) {}
+    thread_per_core(::cocls::thread_per_core &rt, unsigned int n):_home(rt.get_core(n)) {}
+
+    bool is_policy_ready() const noexcept {
+        return _home != nullptr;
+    }
+
+    struct initial_awaiter {
+        thread_per_core &_p;
+        initial_awaiter(thread_per_core &p):_p(p) {}
+        static constexpr bool await_ready() noexcept {return false;}
+        void await_suspend(std::coroutine_handle<> h) {
+            if (_p.is_policy_ready()) _p.resume(h);
+        }
+        static constexpr void await_resume() noexcept {}
+    };
+
+    void resume(std::coroutine_handle<> h) {
+        _node._h = h;
+        _home->send(&_node);
+    }
+
+    std::coroutine_handle<> resume_handle(std::coroutine_handle<> h) {
+        if (_home->is_current()) return h;
+        resume(h);
+        return std::noop_coroutine();
+    }
+
+    ///Initializes policy
+    /**
+     * @param rt runtime
+     * @param n index of home core
+     * @retval true you need to resume coroutine
+     * @retval false you don't need to resume coroutine
+     */
+    bool initialize_policy(::cocls::thread_per_core &rt, unsigned int n) {
+        bool ret = _home == nullptr;
+        _home = rt.get_core(n);
+        return ret;
+    }
+
+    std::coroutine_handle<> resume_handle_next() noexcept {
+        return resumption_policy::queued::resume_handle_next();
+    }
+
+    static bool can_block() {
+        return ::cocls::thread_per_core::core::current() == nullptr;
+    }
+};
+
+}
+
+}
+
+#endif /* SRC_COCLASSES_THREAD_PER_CORE_H_ */
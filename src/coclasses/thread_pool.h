@@ -14,9 +14,14 @@
 #include "resumption_policy.h"
 #include "lazy.h"
 #include "function.h"
+#include "resume_watchdog.h"
+#include "trace.h"
 
+#include <atomic>
 #include <condition_variable>
+#include <deque>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <queue>
@@ -30,11 +35,21 @@ namespace cocls {
 /** Main benefit of such object is zero allocation during transferring the coroutine to the
  * other thread
  *
+ * Synchronous waiting (future::wait(), co_awaiter::sync()) performed in a worker
+ * doesn't block the worker. The worker processes other enqueued items while it is
+ * waiting. This prevents deadlock when awaited work is enqueued behind the waiting
+ * worker.
  */
 
-class thread_pool {
+class thread_pool: protected wait_helper {
 public:
 
+    ///Maximum nesting of waits which process enqueued items
+    /** When a processed item also waits, it is nested. If the nesting is too deep, the
+     * worker is blocked instead
+     */
+    static constexpr unsigned int max_help_depth = 8;
+
     using q_item = function<void()>;
 
     ///Start thread pool
@@ -44,10 +59,19 @@ public:
      */
     thread_pool(unsigned int threads = 0)
     {
-        if (!threads) threads = std::thread::hardware_concurrency();
-        for (unsigned int i = 0; i < threads; i++) {
-            _threads.push_back(std::thread([this]{worker();}));
-        }
+        start_threads(threads);
+    }
+
+    ///Start thread pool monitored by a watchdog
+    /**
+     * @param threads count of threads. Zero creates same amount as count
+     * of available CPU cores (hardware_concurrency)
+     * @param watchdog watchdog which monitors workers. The watchdog must outlive the thread pool
+     */
+    thread_pool(unsigned int threads, resume_watchdog &watchdog)
+        :_watchdog(&watchdog)
+    {
+        start_threads(threads);
     }
 
 
@@ -57,21 +81,126 @@ public:
      * to add a worker. Current thread becomes a worker until stop() is called.
      */
     void worker() {
+        {
+            std::lock_guard _(_mx);
+            ++_target;
+            ++_running;
+        }
+        run_worker();
+    }
+
+    ///Marks the current worker blocked
+    /**
+     * Use this object around a blocking call (legacy driver, blocking I/O) executed
+     * in a worker. While the worker is blocked, the pool activates a compensating
+     * worker, so count of running workers stays at the target. When the blocking
+     * section ends, surplus worker is parked as spare after it finishes its current
+     * item. Spare workers are reused for next blocking sections.
+     *
+     * If the current thread is not a worker of a thread pool, the object does nothing
+     *
+     * @code
+     * pool.run_detached([]{
+     *      thread_pool::blocking_section _;
+     *      legacy_db_query();
+     * });
+     * @endcode
+     */
+    class blocking_section {
+    public:
+        blocking_section():_owner(_current) {
+            if (_owner) _owner->enter_blocking();
+        }
+        blocking_section(const blocking_section &) = delete;
+        blocking_section &operator=(const blocking_section &) = delete;
+        ~blocking_section() {
+            if (_owner) _owner->leave_blocking();
+        }
+    protected:
+        thread_pool *_owner;
+    };
+
+protected:
+
+    void start_threads(unsigned int threads) {
+        if (!threads) threads = std::thread::hardware_concurrency();
+        std::lock_guard _(_mx);
+        _target = threads;
+        _running = threads;
+        for (unsigned int i = 0; i < threads; i++) {
+            _threads.push_back(std::thread([this]{run_worker();}));
+        }
+    }
+
+    void enter_blocking() {
+        std::lock_guard _(_mx);
+        --_running;
+        if (_running < _target && !_exit) {
+            if (_spare > _wake_tokens) {
+                ++_wake_tokens;
+                _spare_cond.notify_one();
+            } else {
+                _threads.push_back(std::thread([this]{run_worker();}));
+            }
+            ++_running;
+        }
+    }
+
+    void leave_blocking() {
+        std::lock_guard _(_mx);
+        ++_running;
+        //surplus worker is parked in run_worker()
+    }
+
+    void run_worker() {
         _current = this;
+        wait_helper::current = this;
+        resume_watchdog::registration wdreg;
+        if (_watchdog) wdreg = _watchdog->attach("thread_pool");
         std::unique_lock lk(_mx);
+        _local = _locals.emplace_back(std::make_unique<local_queue>()).get();
         for(;;) {
-            _cond.wait(lk, [&]{return !_queue.empty() || _exit;});
+            if (_running > _target && !_exit) {
+                //too many running workers, park as spare
+                --_running;
+                ++_spare;
+                //pass possible notification to other worker
+                if (!_queue.empty()) _cond.notify_one();
+                _spare_cond.wait(lk, [&]{return _wake_tokens > 0 || _exit;});
+                --_spare;
+                if (_exit) break;
+                --_wake_tokens;
+                continue;
+            }
+            if (_queue.empty() && !_exit && _stealable.load() == 0) {
+                COCLS_TRACE1(pool_park, this);
+                wait_idle(lk, [&]{return _exit;});
+                COCLS_TRACE2(pool_unpark, this, _queue.size());
+            }
             if (_exit) break;
-            auto h = std::move(_queue.front());
-            _queue.pop();
+            queue_item h;
+            if (!_queue.empty()) {
+                h = std::move(_queue.front());
+                _queue.pop();
+                COCLS_TRACE2(pool_dequeue, this, _queue.size());
+            } else if (!steal(h)) {
+                continue;
+            }
             lk.unlock();
-            resumption_policy::queued::install_queue_and_call(h);
+            {
+                resume_watchdog::scope _(wdreg, h._ident);
+                resumption_policy::queued::install_queue_and_call(h._fn);
+            }
             //if _current is nullptr, thread_pool has been destroyed
             if (_current == nullptr) return;
             lk.lock();
         }
+        _local = nullptr;
+        wait_helper::current = nullptr;
     }
 
+public:
+
     ///Stops all threads
     /**
      * Stopped threads cannot be restarted
@@ -83,6 +212,7 @@ public:
             std::unique_lock lk(_mx);
             _exit = true;
             _cond.notify_all();
+            _spare_cond.notify_all();
             std::swap(tmp, _threads);
             std::swap(q, _queue);
         }
@@ -92,6 +222,8 @@ public:
                 t.detach();
                 //mark this thread as ordinary thread
                 _current = nullptr;
+                _local = nullptr;
+                wait_helper::current = nullptr;
             }
             else {
                 t.join();
@@ -139,7 +271,7 @@ public:
         static constexpr bool await_ready() {return false;}
 
         void await_suspend(std::coroutine_handle<> h) {
-            _owner->enqueue(resume_ntf_cancel(h, this));
+            _owner->enqueue(resume_ntf_cancel(h, this), h.address());
         }
 
         void await_resume() {
@@ -218,6 +350,14 @@ public:
         if (t) run_detached(t.bind(std::forward<Args>(args)...));
     }
 
+    ///Resume coroutine in thread pool
+    /**
+     * @param h handle of coroutine to resume
+     */
+    void resume(std::coroutine_handle<> h) {
+        enqueue(q_item([=]{h.resume();}), h.address());
+    }
+
 private:
 
     template<typename T, typename P>
@@ -265,6 +405,58 @@ public:
 
 
 
+    ///Push function to the deque of the current worker
+    /**
+     * The deque is private to the worker, but idle workers of the same pool can steal
+     * items from it. The owner takes the item back by take_local(). This is intended to
+     * implement fork-join, where the continuation of the parent is pushed to
+     * the deque while the child runs inline.
+     *
+     * @param fn function to push
+     * @param ident identity of the item, used by take_local()
+     * @retval true pushed
+     * @retval false current thread is not a worker of a thread pool
+     *
+     * @see fork_scope
+     */
+    static bool push_local(q_item &&fn, const void *ident) {
+        thread_pool *p = _current;
+        local_queue *l = _local;
+        if (!p || !l) return false;
+        {
+            std::lock_guard _(l->_mx);
+            l->_items.push_back(queue_item{std::move(fn), ident});
+        }
+        p->_stealable.fetch_add(1);
+        //wake one idle worker. Until it wakes up, further pushes don't touch the pool's lock
+        if (p->_idle.load() != 0 && !p->_wake_pending.exchange(true)) {
+            std::lock_guard _(p->_mx);
+            p->_cond.notify_one();
+        }
+        return true;
+    }
+
+    ///Take back the item pushed by push_local()
+    /**
+     * @param ident identity of the item
+     * @retval true item was still in the deque, it was removed without being called
+     * @retval false item was stolen by other worker (or it is not the last item in the deque)
+     */
+    static bool take_local(const void *ident) {
+        thread_pool *p = _current;
+        local_queue *l = _local;
+        if (!p || !l) return false;
+        queue_item h;
+        {
+            std::lock_guard _(l->_mx);
+            if (l->_items.empty() || l->_items.back()._ident != ident) return false;
+            h = std::move(l->_items.back());
+            l->_items.pop_back();
+        }
+        p->_stealable.fetch_sub(1);
+        return true;
+    }
+
     struct current {
 
         class  current_awaiter: public co_awaiter {
@@ -293,6 +485,20 @@ public:
 
         }
 
+        ///Run function in the thread pool of current worker
+        /**
+         * @param fn function to run
+         * @retval true function has been enqueued
+         * @retval false current thread is not a worker of a thread pool
+         */
+        template<typename Fn>
+        static bool run_detached(Fn &&fn) {
+            thread_pool *c = _current;
+            if (!c) return false;
+            c->run_detached(std::forward<Fn>(fn));
+            return true;
+        }
+
     };
 
     bool is_stopped() const {
@@ -318,10 +524,94 @@ public:
 protected:
 
 
-    void enqueue(q_item &&fn) {
+    virtual void help_until(std::atomic<bool> &flag) noexcept override {
+        if (_current != this || _help_depth >= max_help_depth) {
+            flag.wait(false);
+            return;
+        }
+        ++_help_depth;
+        std::unique_lock lk(_mx);
+        while (!flag.load(std::memory_order_acquire)) {
+            if (_exit) {
+                lk.unlock();
+                flag.wait(false);
+                break;
+            }
+            queue_item h;
+            if (!_queue.empty()) {
+                h = std::move(_queue.front());
+                _queue.pop();
+                COCLS_TRACE2(pool_dequeue, this, _queue.size());
+            } else if (!steal(h)) {
+                wait_idle(lk, [&]{return _exit || flag.load(std::memory_order_acquire);});
+                continue;
+            }
+            lk.unlock();
+            resumption_policy::queued::install_queue_and_call(h._fn);
+            //thread_pool has been destroyed
+            if (_current != this) {
+                flag.wait(false);
+                break;
+            }
+            lk.lock();
+        }
+        --_help_depth;
+    }
+
+    virtual void notify(std::atomic<bool> &flag) noexcept override {
+        //flag must be set under lock, otherwise the waiting worker can miss the notification
+        //notify under lock, because waiting worker can destroy the pool after lock is released
+        std::lock_guard _(_mx);
+        flag.store(true, std::memory_order_release);
+        flag.notify_all();
+        _cond.notify_all();
+    }
+
+    struct queue_item {
+        q_item _fn;
+        //identity of the coroutine (for watchdog), can be nullptr
+        const void *_ident = nullptr;
+    };
+
+    //deque of a worker, the owner uses back, thieves use front
+    struct local_queue {
+        std::mutex _mx;
+        std::deque<queue_item> _items;
+    };
+
+    //under lock _mx, waits until an item is available or the predicate is satisfied
+    template<typename Pred>
+    void wait_idle(std::unique_lock<std::mutex> &lk, Pred &&pred) {
+        ++_idle;
+        _wake_pending.store(false);
+        _cond.wait(lk, [&]{return pred() || !_queue.empty() || _stealable.load() != 0;});
+        --_idle;
+        //next push_local() can wake other worker
+        _wake_pending.store(false);
+    }
+
+    //under lock _mx, steals the oldest item of other worker
+    bool steal(queue_item &h) {
+        std::size_t cnt = _locals.size();
+        for (std::size_t i = 0; i < cnt; i++) {
+            local_queue &l = *_locals[(_steal_pos + i) % cnt];
+            std::lock_guard _(l._mx);
+            if (!l._items.empty()) {
+                h = std::move(l._items.front());
+                l._items.pop_front();
+                _stealable.fetch_sub(1);
+                _steal_pos = (_steal_pos + i + 1) % cnt;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void enqueue(q_item &&fn, const void *ident = nullptr) {
         std::lock_guard _(_mx);
         if (!_exit) {
-            _queue.push(std::move(fn));
+            _queue.push(queue_item{std::move(fn), ident});
+            COCLS_TRACE2(pool_enqueue, this, _queue.size());
             _cond.notify_one();
         }
     }
@@ -329,10 +619,31 @@ protected:
 
     mutable std::mutex _mx;
     std::condition_variable _cond;
-    std::queue<q_item> _queue;
+    std::condition_variable _spare_cond;
+    //count of threads which should run (not blocked)
+    unsigned int _target = 0;
+    //count of threads which are not blocked and not spare
+    unsigned int _running = 0;
+    //count of parked spare threads
+    unsigned int _spare = 0;
+    //count of spare threads requested to wake up
+    unsigned int _wake_tokens = 0;
+    std::queue<queue_item> _queue;
     std::vector<std::thread> _threads;
+    //deques of workers
+    std::vector<std::unique_ptr<local_queue> > _locals;
+    std::size_t _steal_pos = 0;
+    //count of items in deques of workers
+    std::atomic<unsigned int> _stealable = 0;
+    //count of workers waiting for an item
+    std::atomic<unsigned int> _idle = 0;
+    //an idle worker is being woken by push_local()
+    std::atomic<bool> _wake_pending = false;
     bool _exit = false;
+    resume_watchdog *_watchdog = nullptr;
     static thread_local thread_pool *_current;
+    static thread_local unsigned int _help_depth;
+    static thread_local local_queue *_local;
 
 
 
@@ -340,6 +651,8 @@ protected:
 };
 
 inline thread_local thread_pool *thread_pool::_current = nullptr;
+inline thread_local unsigned int thread_pool::_help_depth = 0;
+inline thread_local thread_pool::local_queue *thread_pool::_local = nullptr;
 
 using shared_thread_pool = std::shared_ptr<thread_pool>;
 
@@ -370,16 +683,12 @@ struct thread_pool {
     using initial_awaiter = initial_resume_by_policy<thread_pool>;
 
     void resume(std::coroutine_handle<> h) {
-        _cur_pool->run_detached([=]{
-            h.resume();
-        });
+        _cur_pool->resume(h);
     }
 
     std::coroutine_handle<> resume_handle(std::coroutine_handle<> h) noexcept {
         if (is_current(*_cur_pool)) return h;
-        _cur_pool->run_detached([=]{
-            h.resume();
-        });
+        _cur_pool->resume(h);
         return std::noop_coroutine();
     }
 
@@ -0,0 +1,54 @@
+/**
+ * @file trace.h
+ *
+ * Static tracepoints (USDT)
+ *
+ * When macro COCLS_ENABLE_USDT is defined and the header <sys/sdt.h> is available (systemtap-sdt-dev),
+ * the library places USDT probes at important places (provider "cocls"). The probes compile
+ * to a single NOP instruction, which can be activated by a tracer (bpftrace, perf, systemtap) without
+ * rebuilding the program. Without COCLS_ENABLE_USDT the macros expand to nothing, and
+ * arguments are not evaluated.
+ *
+ * Available probes
+ *
+ * | probe                | arguments                                     |
+ * |----------------------|-----------------------------------------------|
+ * | pool_enqueue         | thread_pool *, queue length after enqueue     |
+ * | pool_dequeue         | thread_pool *, queue length after dequeue     |
+ * | pool_park            | thread_pool *                                 |
+ * | pool_unpark          | thread_pool *, queue length                   |
+ * | future_resolve       | future *                                      |
+ * | awaiter_resume       | coroutine address                             |
+ * | mutex_contended_lock | mutex *, awaiter *                            |
+ * | mutex_handoff_unlock | mutex *, awaiter *                            |
+ * | timer_fire           | scheduler *, count of remaining timers        |
+ * | poolalloc_miss       | block size                                    |
+ *
+ * @code
+ * bpftrace -e 'usdt:./program:cocls:pool_enqueue { @depth = hist(arg1); }'
+ * @endcode
+ */
+#pragma once
+#ifndef SRC_COCLASSES_TRACE_H_
+#define SRC_COCLASSES_TRACE_H_
+
+#ifdef COCLS_ENABLE_USDT
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define COCLS_USDT_AVAILABLE
+#endif
+#endif
+
+#ifdef COCLS_USDT_AVAILABLE
+#define COCLS_TRACE0(name) DTRACE_PROBE(cocls, name)
+#define COCLS_TRACE1(name, a) DTRACE_PROBE1(cocls, name, a)
+#define COCLS_TRACE2(name, a, b) DTRACE_PROBE2(cocls, name, a, b)
+#define COCLS_TRACE3(name, a, b, c) DTRACE_PROBE3(cocls, name, a, b, c)
+#else
+#define COCLS_TRACE0(name) ((void)0)
+#define COCLS_TRACE1(name, a) ((void)0)
+#define COCLS_TRACE2(name, a, b) ((void)0)
+#define COCLS_TRACE3(name, a, b, c) ((void)0)
+#endif
+
+#endif /* SRC_COCLASSES_TRACE_H_ */
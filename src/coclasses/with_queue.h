@@ -12,7 +12,7 @@
 ///
 namespace cocls {
 
-template<typename Coro, typename T>
+template<typename Coro, typename T, typename Queue>
 class with_queue_promise;
 
 
@@ -27,12 +27,14 @@ class with_queue_promise;
  *
  * @tparam Coro type of coroutine (task<> or generator<>)
  * @tparam T type of item in queue
+ * @tparam Queue type of the queue. It must have functions push(T &&), push(const T &) and
+ * pop(), which returns an awaitable object. Default queue is cocls::queue
  */
-template<typename Coro, typename T>
+template<typename Coro, typename T, typename Queue = queue<T, primitives::std_queue, primitives::single_item_queue> >
 class with_queue: public Coro {
 public:
 
-    using promise_type = with_queue_promise<Coro, T>;
+    using promise_type = with_queue_promise<Coro, T, Queue>;
     with_queue(Coro &&x):Coro(std::move(x)) {}
     with_queue() {}
 
@@ -44,7 +46,7 @@ public:
      *
      */
     void push(T &&t) {
-        static_cast<with_queue_promise<Coro, T> *>(this->get_promise())->push(std::move(t));
+        static_cast<promise_type *>(this->get_promise())->push(std::move(t));
     }
     ///Push a value to the coroutine
     /**
@@ -52,17 +54,22 @@ public:
      *
      */
     void push(const T &t) {
-        static_cast<with_queue_promise<Coro, T> *>(this->get_promise())->push(t);
+        static_cast<promise_type *>(this->get_promise())->push(t);
+    }
+
+    ///Retrieve the queue of the coroutine
+    Queue &get_queue() {
+        return static_cast<promise_type *>(this->get_promise())->_q;
     }
 
 };
 
 
-template<typename Coro, typename T>
+template<typename Coro, typename T, typename Queue>
 class with_queue_promise: public Coro::promise_type {
 public:
 
-    using queue_t = queue<T, primitives::std_queue, primitives::single_item_queue>;
+    using queue_t = Queue;
 
     queue_t _q;
 
@@ -74,8 +81,8 @@ public:
     }
 
 
-    with_queue<Coro,T> get_return_object() {
-        return with_queue<Coro,T>(std::move(Coro::promise_type::get_return_object()));
+    with_queue<Coro,T,Queue> get_return_object() {
+        return with_queue<Coro,T,Queue>(std::move(Coro::promise_type::get_return_object()));
     }
 
     auto yield_value(std::monostate) {
@@ -0,0 +1,158 @@
+/**
+ * @file with_timeout.h
+ *
+ * Timeout combinator for futures
+ */
+#pragma once
+#ifndef SRC_COCLASSES_WITH_TIMEOUT_H_
+#define SRC_COCLASSES_WITH_TIMEOUT_H_
+
+#include "future.h"
+#include "scheduler.h"
+
+#include <atomic>
+#include <chrono>
+#include <optional>
+
+namespace cocls {
+
+///Awaiter which waits for a future limited by a timeout
+/**
+ * The awaiter is subscribed to the future and to a timer of the scheduler at the same
+ * time. The first event wins the race. When the future wins, the timer is removed
+ * from the scheduler without searching. When the timer wins, the awaiter is unsubscribed
+ * from the future, so the future can be awaited again later. No coroutine frame is
+ * allocated, the whole state lives in the awaiter
+ *
+ * Result of co_await is std::optional<T> (or bool for future<void>). It is empty (false)
+ * when timeout expired. If the future is resolved with an exception, the exception is
+ * thrown.
+ *
+ * @tparam Fut type of future (future<T>, unique_future<T>)
+ *
+ * @note the future can still be pending after timeout. It must be kept valid until it
+ * is resolved
+ */
+template<typename Fut>
+class [[nodiscard]] with_timeout_awaiter: public co_awaiter_policy_base<Fut> {
+public:
+
+    using value_type = typename _details::IsFuture<Fut>::Type;
+    using result_type = std::conditional_t<std::is_void_v<value_type>, bool, std::optional<value_type> >;
+
+    with_timeout_awaiter(Fut &fut, scheduler &sch, std::chrono::system_clock::time_point tp)
+        :co_awaiter_policy_base<Fut>(fut), _sch(sch), _tp(tp) {}
+    //copied only before it is awaited
+    with_timeout_awaiter(const with_timeout_awaiter &other)
+        :co_awaiter_policy_base<Fut>(other), _sch(other._sch), _tp(other._tp) {}
+
+    ///co_await related function
+    bool await_ready() {
+        return this->_owner.ready();
+    }
+    ///co_await related function
+    bool await_suspend(std::coroutine_handle<> h) {
+        this->_h = h;
+        _op._self = this;
+        _tm._self = this;
+        //timer first, so completed operation has always a timer to cancel
+        _sch.schedule(_timer, _timer_fut.get_promise(), _tp);
+        if (!this->_owner.subscribe(&_op)) _op.resume();
+        if (!_timer_fut.subscribe(&_tm)) _tm.resume();
+        return !finish(1);
+    }
+    ///co_await related function
+    /**
+     * @return value of the future, or empty value when timeout expired
+     */
+    result_type await_resume() {
+        //the value is returned when it is available, even if the timer won
+        if (!this->_owner.ready()) return result_type();
+        if constexpr(std::is_void_v<value_type>) {
+            this->_owner.value();
+            return true;
+        } else if constexpr(std::is_same_v<Fut, unique_future<value_type> >) {
+            return std::move(this->_owner.value());
+        } else {
+            return this->_owner.value();
+        }
+    }
+
+protected:
+
+    class listener: public abstract_awaiter {
+    public:
+        listener(void (with_timeout_awaiter::*fn)()):_fn(fn) {}
+        virtual void resume() noexcept override {
+            (_self->*_fn)();
+        }
+        with_timeout_awaiter *_self = nullptr;
+        void (with_timeout_awaiter::*_fn)();
+    };
+
+    struct state {
+        static constexpr int pending = 0;
+        static constexpr int completed = 1;
+        static constexpr int timeout = 2;
+    };
+
+    scheduler &_sch;
+    std::chrono::system_clock::time_point _tp;
+    scheduler::timer _timer;
+    future<void> _timer_fut;
+    listener _op = &with_timeout_awaiter::on_complete;
+    listener _tm = &with_timeout_awaiter::on_timer;
+    std::atomic<int> _state = state::pending;
+    //operation, timer and await_suspend itself
+    std::atomic<int> _pending = 3;
+
+    bool finish(int n) {
+        return _pending.fetch_sub(n, std::memory_order_acq_rel) == n;
+    }
+
+    void on_complete() {
+        int s = state::pending;
+        if (_state.compare_exchange_strong(s, state::completed, std::memory_order_acq_rel)) {
+            //timer's future is resolved by cancel or by the timer itself
+            _sch.cancel(_timer);
+        }
+        if (finish(1)) this->resume();
+    }
+
+    void on_timer() {
+        int s = state::pending;
+        int n = 1;
+        if (_state.compare_exchange_strong(s, state::timeout, std::memory_order_acq_rel)
+                && this->_owner.unsubscribe(&_op)) {
+            //operation will not signal, finish it here
+            n = 2;
+        }
+        if (finish(n)) this->resume();
+    }
+};
+
+///Await a future with a timeout
+/**
+ * @param fut future to await. It must be kept valid until it is resolved
+ * @param dur timeout
+ * @param sch scheduler which handles the timeout
+ * @return awaiter. Result of co_await is std::optional<T> (or bool for future<void>),
+ * which is empty (false) when timeout expired
+ *
+ * @code
+ * cocls::future<int> f = read_value();
+ * std::optional<int> r = co_await cocls::with_timeout(f, std::chrono::seconds(1), sch);
+ * if (!r) {
+ *      //timeout - f is still pending
+ * }
+ * @endcode
+ */
+template<typename Fut, typename A, typename B>
+CXX20_REQUIRES(_details::IsFuture<Fut>::value)
+with_timeout_awaiter<Fut> with_timeout(Fut &fut, std::chrono::duration<A,B> dur, scheduler &sch) {
+    return with_timeout_awaiter<Fut>(fut, sch, std::chrono::system_clock::now() + dur);
+}
+
+}
+
+#endif /* SRC_COCLASSES_WITH_TIMEOUT_H_ */
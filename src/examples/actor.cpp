@@ -0,0 +1,36 @@
+#include <iostream>
+#include <coclasses/actor.h>
+
+#include <atomic>
+#include <vector>
+
+static std::atomic<long> total = 0;
+
+cocls::actor<int> counter_actor(int id) {
+    long sum = 0;
+    for(;;) {
+        int v = co_yield {};
+        if (v == 0) break;
+        sum += v;
+    }
+    total += sum;
+}
+
+
+int main(int, char **) {
+    cocls::thread_pool pool(4);
+    constexpr int actors = 10000;
+    std::vector<cocls::actor<int> > list;
+    list.reserve(actors);
+    for (int i = 0; i < actors; i++) {
+        list.push_back(counter_actor(i));
+        cocls::start_actor(list.back(), pool);
+    }
+    //all actors are idle now, no worker is occupied
+    for (int j = 0; j < 100; j++) {
+        for (auto &a: list) a.push(1);
+    }
+    for (auto &a: list) a.push(0);
+    for (auto &a: list) a.join();
+    std::cout << "Total: " << total << " (expected " << actors * 100 << ")" << std::endl;
+}
@@ -0,0 +1,46 @@
+#include <iostream>
+#include <atomic>
+#include <coclasses/task.h>
+#include <coclasses/adaptive_limiter.h>
+#include <coclasses/scheduler.h>
+
+//simulated downstream, it can process 10 requests in parallel, extra requests are queued
+static std::atomic<int> concurrent = 0;
+static std::atomic<int> max_concurrent = 0;
+
+cocls::future<int> downstream(cocls::scheduler &sch, int v) {
+    int c = ++concurrent;
+    int m = max_concurrent;
+    while (c > m && !max_concurrent.compare_exchange_weak(m, c));
+    int queued = std::max(0, c - 10);
+    co_await sch.sleep_for(std::chrono::milliseconds(2 + queued));
+    --concurrent;
+    co_return v;
+}
+
+cocls::task<> client(cocls::adaptive_limiter &limiter, cocls::scheduler &sch, int count, long &sum) {
+    for (int i = 0; i < count; i++) {
+        sum += co_await limiter.run([&]{return downstream(sch, 1);});
+    }
+}
+
+int main(int, char **) {
+    cocls::thread_pool pool(4);
+    cocls::scheduler sch(pool);
+    cocls::adaptive_limiter limiter;
+
+    constexpr int clients = 200;
+    constexpr int requests = 20;
+    std::vector<long> sums(clients, 0);
+    std::vector<cocls::task<> > tasks;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < clients; i++) tasks.push_back(client(limiter, sch, requests, sums[i]));
+    for (auto &t: tasks) t.join();
+    auto dur = std::chrono::steady_clock::now() - start;
+    long total = 0;
+    for (long s: sums) total += s;
+    std::cout << "Requests: " << total << " (expected " << clients * requests << ") in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(dur).count() << " ms" << std::endl;
+    std::cout << "Final limit: " << limiter.limit() << std::endl;
+    std::cout << "Max concurrent requests at downstream: " << max_concurrent << " (clients: " << clients << ")" << std::endl;
+}
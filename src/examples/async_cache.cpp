@@ -0,0 +1,72 @@
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <coclasses/task.h>
+#include <coclasses/async_cache.h>
+#include <coclasses/scheduler.h>
+#include <coclasses/thread_pool.h>
+
+using namespace std::chrono_literals;
+
+using cache_t = cocls::async_cache<int, std::string>;
+
+std::atomic<int> loads = 0;
+std::atomic<bool> fail_next = false;
+
+//simulated slow backend
+cocls::future<std::string> load(cocls::scheduler &sch, int key) {
+    ++loads;
+    co_await sch.sleep_for(20ms);
+    if (fail_next.exchange(false)) throw std::runtime_error("backend failure");
+    co_return "value " + std::to_string(key);
+}
+
+cocls::task<> reader(cache_t &cache, cocls::scheduler &sch, int key) {
+    std::string v = co_await cache.get(key, [&](int k){return load(sch, k);});
+    if (v != "value " + std::to_string(key)) std::cout << "Unexpected value " << v << std::endl;
+}
+
+cocls::task<> failing_reader(cache_t &cache, cocls::scheduler &sch, int &failures) {
+    for(;;) {
+        try {
+            co_await cache.get(7, [&](int k){return load(sch, k);});
+            break;
+        } catch (const std::exception &) {
+            //retry
+            ++failures;
+        }
+    }
+}
+
+void burst(cache_t &cache, cocls::scheduler &sch, int key, int count) {
+    std::vector<cocls::task<> > tasks;
+    for (int i = 0; i < count; i++) tasks.push_back(reader(cache, sch, key));
+    for (auto &t: tasks) t.join();
+}
+
+int main(int, char **) {
+    cocls::thread_pool pool(2);
+    cocls::scheduler sch(pool);
+    cache_t cache(128, 100ms);
+
+    burst(cache, sch, 1, 100);
+    std::cout << "100 concurrent misses: " << loads << " load(s)" << std::endl;
+    burst(cache, sch, 1, 100);
+    std::cout << "100 hits: " << loads << " load(s)" << std::endl;
+    std::this_thread::sleep_for(150ms);
+    burst(cache, sch, 1, 100);
+    std::cout << "After TTL: " << loads << " load(s)" << std::endl;
+
+    loads = 0;
+    fail_next = true;
+    int failures = 0;
+    std::vector<cocls::task<> > tasks;
+    for (int i = 0; i < 10; i++) tasks.push_back(failing_reader(cache, sch, failures));
+    for (auto &t: tasks) t.join();
+    std::cout << "Failed load: " << failures << " waiters failed, " << loads << " load(s) including retry" << std::endl;
+
+    loads = 0;
+    for (int i = 0; i < 300; i++) burst(cache, sch, i, 1);
+    std::cout << "Entries after 300 keys: " << cache.size() << " (limit 128)" << std::endl;
+}
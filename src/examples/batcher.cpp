@@ -0,0 +1,45 @@
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <coclasses/task.h>
+#include <coclasses/batcher.h>
+#include <coclasses/thread_pool.h>
+
+using namespace std::chrono_literals;
+
+std::atomic<int> batches = 0;
+
+//simulated storage - one write takes 1ms regardless on size of the batch
+cocls::future<std::vector<int> > write_batch(cocls::scheduler &sch, std::vector<int> reqs) {
+    ++batches;
+    co_await sch.sleep_for(1ms);
+    for (auto &x: reqs) x = x * 2;
+    co_return std::move(reqs);
+}
+
+cocls::task<> writer(cocls::batcher<int, int> &b, int v) {
+    int r = co_await b.submit(v);
+    if (r != v * 2) std::cout << "Unexpected response " << r << " for " << v << std::endl;
+}
+
+int main(int, char **) {
+    cocls::thread_pool pool(2);
+    cocls::scheduler sch(pool);
+    cocls::batcher<int, int> b(sch, [&](std::vector<int> &&reqs) {
+        return write_batch(sch, std::move(reqs));
+    }, 64, 2ms);
+
+    std::vector<cocls::task<> > tasks;
+    for (int i = 0; i < 1000; i++) tasks.push_back(writer(b, i));
+    for (auto &t: tasks) t.join();
+    std::cout << "1000 requests in " << batches << " batches (max size 64)" << std::endl;
+
+    batches = 0;
+    tasks.clear();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 5; i++) tasks.push_back(writer(b, i));
+    for (auto &t: tasks) t.join();
+    auto dur = std::chrono::steady_clock::now() - start;
+    std::cout << "5 requests in " << batches << " batch closed by timer after "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(dur).count() << " ms" << std::endl;
+}
@@ -0,0 +1,65 @@
+#include <iostream>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <coclasses/dag_executor.h>
+
+using node_id = cocls::dag_executor::node_id;
+
+static void work() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+}
+
+//chain of dependent nodes and many independent nodes. The chain is the critical path
+void critical_path(cocls::thread_pool &pool) {
+    constexpr int chain = 40;
+    constexpr int independent = 120;
+    cocls::dag_executor dag;
+    //independent nodes are added first, so they would be started first without priorities
+    for (int i = 0; i < independent; i++) dag.add(work);
+    node_id prev = dag.add(work);
+    for (int i = 1; i < chain; i++) prev = dag.add(work, {prev});
+
+    auto start = std::chrono::steady_clock::now();
+    dag.run(pool, 4).join();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Nodes: " << dag.size() << ", time: " << ms << " ms, lower bound: "
+              << chain * 2 << " ms, without priorities: " << (independent / 4 + chain) * 2 << " ms" << std::endl;
+}
+
+//failed node skips its dependents, other branches continue
+void failure(cocls::thread_pool &pool) {
+    cocls::dag_executor dag;
+    auto a = dag.add(work);
+    auto b = dag.add([]{throw std::runtime_error("node b failed");});
+    auto c = dag.add(work, {a});
+    auto d = dag.add(work, {b});
+    auto e = dag.add(work, {c, d});
+    auto f = dag.add([]() -> cocls::future<void> {
+        //node can be asynchronous
+        return [](auto promise) {
+            std::thread([promise = std::move(promise)]() mutable {
+                work();
+                promise();
+            }).detach();
+        };
+    }, {c});
+
+    try {
+        dag.run(pool).join();
+    } catch (const std::exception &ex) {
+        std::cout << "Graph failed: " << ex.what() << std::endl;
+    }
+    const char *names[] = {"pending","running","done","failed","skipped"};
+    for (auto id: {a,b,c,d,e,f}) {
+        std::cout << static_cast<char>('a'+id) << ": "
+                  << names[static_cast<int>(dag.get_status(id))] << std::endl;
+    }
+}
+
+int main(int, char **) {
+    cocls::thread_pool pool(4);
+    critical_path(pool);
+    failure(pool);
+    return 0;
+}
@@ -0,0 +1,62 @@
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <coclasses/delay_queue.h>
+#include <coclasses/task.h>
+#include <coclasses/thread_pool.h>
+
+using clk = std::chrono::system_clock;
+
+struct retry {
+    int id;
+    clk::time_point due;
+};
+
+struct stats {
+    std::atomic<int> received = 0;
+    std::atomic<int> early = 0;
+    std::atomic<long> max_late_us = 0;
+};
+
+cocls::task<> consumer(cocls::delay_queue<retry> &q, stats &st, int count) {
+    for (int i = 0; i < count; i++) {
+        retry r = co_await q.pop();
+        auto now = clk::now();
+        if (now < r.due) ++st.early;
+        long late = static_cast<long>(std::chrono::duration_cast<std::chrono::microseconds>(now - r.due).count());
+        long m = st.max_late_us.load();
+        while (late > m && !st.max_late_us.compare_exchange_weak(m, late));
+        ++st.received;
+    }
+}
+
+int main(int, char **) {
+    constexpr int items = 2000;
+    cocls::thread_pool pool(2);
+    cocls::scheduler sch(pool);
+    cocls::delay_queue<retry> q(sch);
+    stats st;
+
+    auto c1 = consumer(q, st, items / 2);
+    auto c2 = consumer(q, st, items / 2);
+
+    //backoff delays up to 100ms, pushed in random order
+    std::mt19937 rnd(1);
+    auto start = clk::now();
+    for (int i = 0; i < items; i++) {
+        auto delay = std::chrono::microseconds(rnd() % 100000);
+        q.push(retry{i, start + delay}, start + delay);
+    }
+    std::cout << "Pending: " << q.size() << std::endl;
+    c1.join();
+    c2.join();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(clk::now() - start).count();
+    std::cout << "Received: " << st.received << ", early: " << st.early
+              << ", max lateness: " << st.max_late_us / 1000 << " ms, time: " << ms << " ms" << std::endl;
+
+    //item ready now is passed without timer
+    q.push(retry{-1, clk::now()}, clk::now());
+    std::cout << "Immediate: " << q.pop().wait().id << ", left: " << q.size() << std::endl;
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <coclasses/scheduler.h>
+#include <coclasses/task.h>
+
+using namespace std::chrono_literals;
+
+static long elapsed(std::chrono::steady_clock::time_point start) {
+    return static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+//processing of each tick takes 3ms, the rate doesn't drift
+cocls::task<> no_drift(cocls::scheduler &sch) {
+    auto start = std::chrono::steady_clock::now();
+    auto gen = sch.interval(10ms);
+    std::size_t n = 0;
+    while (n < 50) {
+        co_await gen.next();
+        n = gen.value() + 1;
+        std::this_thread::sleep_for(3ms);
+    }
+    std::cout << "50 ticks of 10ms with processing 3ms: " << elapsed(start) << " ms" << std::endl;
+}
+
+//tick 2 takes 35ms
+cocls::task<> missed(cocls::scheduler &sch, cocls::scheduler::missed_tick policy, const char *name) {
+    auto start = std::chrono::steady_clock::now();
+    auto gen = sch.fixed_rate(10ms, policy);
+    std::cout << name << ":";
+    for (int i = 0; i < 8; i++) {
+        co_await gen.next();
+        std::size_t n = gen.value();
+        std::cout << " " << n << "@" << (elapsed(start) + 5) / 10 * 10;
+        if (i == 2) std::this_thread::sleep_for(35ms);
+    }
+    std::cout << std::endl;
+}
+
+cocls::task<> fixed_delay(cocls::scheduler &sch) {
+    auto start = std::chrono::steady_clock::now();
+    auto gen = sch.fixed_delay(10ms);
+    for (int i = 0; i < 10; i++) {
+        co_await gen.next();
+        std::this_thread::sleep_for(5ms);
+    }
+    std::cout << "fixed_delay 10 ticks of 10ms with processing 5ms: " << elapsed(start) << " ms" << std::endl;
+}
+
+cocls::task<> stopped(cocls::scheduler &sch) {
+    std::stop_source stp;
+    auto gen = sch.fixed_rate(1s, cocls::scheduler::missed_tick::skip, stp.get_token());
+    std::thread thr([&]{
+        std::this_thread::sleep_for(20ms);
+        stp.request_stop();
+    });
+    auto start = std::chrono::steady_clock::now();
+    bool has = co_await gen.next();
+    std::cout << "Stopped generator: " << (has?"tick":"finished") << " after " << elapsed(start) << " ms" << std::endl;
+    thr.join();
+}
+
+int main(int, char **) {
+    cocls::thread_pool pool(2);
+    cocls::scheduler sch(pool);
+    no_drift(sch).join();
+    missed(sch, cocls::scheduler::missed_tick::burst, "burst").join();
+    missed(sch, cocls::scheduler::missed_tick::skip, "skip ").join();
+    missed(sch, cocls::scheduler::missed_tick::delay, "delay").join();
+    fixed_delay(sch).join();
+    stopped(sch).join();
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <numeric>
+#include <random>
+#include <vector>
+#include <coclasses/fork_join.h>
+
+//parallel quicksort
+cocls::async<void> quicksort(int *beg, int *end) {
+    if (end - beg < 2000) {
+        std::sort(beg, end);
+        co_return;
+    }
+    int pivot = beg[(end - beg) / 2];
+    int *m1 = std::partition(beg, end, [&](int x){return x < pivot;});
+    int *m2 = std::partition(m1, end, [&](int x){return !(pivot < x);});
+    cocls::fork_scope scope;
+    co_await scope.fork(quicksort(beg, m1));
+    co_await scope.fork(quicksort(m2, end));
+    co_await scope.join();
+}
+
+//tree reduction, children are functions
+std::atomic<long> leaves = 0;
+cocls::async<long> reduce(const int *beg, const int *end) {
+    if (end - beg < 1000) {
+        ++leaves;
+        co_return std::accumulate(beg, end, 0L);
+    }
+    const int *mid = beg + (end - beg) / 2;
+    long left = 0, right = 0;
+    cocls::fork_scope scope;
+    co_await scope.fork([&]{left = std::accumulate(beg, mid, 0L);});
+    co_await scope.fork([&]{right = std::accumulate(mid, end, 0L);});
+    co_await scope.join();
+    co_return left + right;
+}
+
+//failing child
+cocls::async<void> failing(int depth) {
+    if (depth == 0) throw std::runtime_error("leaf failed");
+    cocls::fork_scope scope;
+    co_await scope.fork(failing(depth - 1));
+    co_await scope.fork([]{});
+    co_await scope.join();
+}
+
+static std::vector<int> make_data(std::size_t n) {
+    std::vector<int> v(n);
+    std::mt19937 rnd(1);
+    for (auto &x: v) x = static_cast<int>(rnd() % 1000000);
+    return v;
+}
+
+template<typename Fn>
+static long measure(Fn &&fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    return static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+int main(int, char **) {
+    constexpr std::size_t n = 2000000;
+    cocls::thread_pool pool(4);
+
+    auto v1 = make_data(n);
+    auto v2 = v1;
+    auto v3 = v1;
+    auto t_sort = measure([&]{std::sort(v1.begin(), v1.end());});
+    //outside of the pool, children are executed serially
+    auto t_serial = measure([&]{cocls::future<void>(quicksort(v2.data(), v2.data() + n)).wait();});
+    auto t_pool = measure([&]{pool.run(quicksort(v3.data(), v3.data() + n)).wait();});
+    std::cout << "std::sort: " << t_sort << " ms, serial fork: " << t_serial
+              << " ms, pool fork: " << t_pool << " ms" << std::endl;
+    std::cout << "Sorted: " << (v1 == v2 && v1 == v3 ? "yes" : "no") << std::endl;
+
+    long sum = pool.run(reduce(v1.data(), v1.data() + n)).join();
+    std::cout << "Sum: " << sum << ", expected: " << std::accumulate(v1.begin(), v1.end(), 0L) << std::endl;
+
+    try {
+        pool.run(failing(10)).join();
+    } catch (const std::exception &e) {
+        std::cout << "Exception: " << e.what() << std::endl;
+    }
+    return 0;
+}
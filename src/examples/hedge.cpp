@@ -0,0 +1,61 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <coclasses/task.h>
+#include <coclasses/hedge.h>
+#include <coclasses/thread_pool.h>
+
+using namespace std::chrono_literals;
+
+//simulated replica - 1% of requests are very slow
+class replica {
+public:
+    replica(cocls::scheduler &sch):_sch(sch) {}
+
+    cocls::future<int> call(std::stop_token stp) {
+        ++_calls;
+        auto dur = _dist(_rnd) < 0.01?std::chrono::microseconds(50000):std::chrono::microseconds(1000);
+        co_await _sch.sleep_for(dur);
+        if (stp.stop_requested()) ++_wasted;
+        co_return 42;
+    }
+
+    int calls() const {return _calls;}
+    int wasted() const {return _wasted;}
+
+protected:
+    cocls::scheduler &_sch;
+    std::mt19937 _rnd{1};
+    std::uniform_real_distribution<double> _dist{0.0, 1.0};
+    std::atomic<int> _calls = 0;
+    std::atomic<int> _wasted = 0;
+};
+
+cocls::task<> run(cocls::scheduler &sch, replica &r, cocls::hedge_delay *delay, int count) {
+    std::vector<double> lat;
+    for (int i = 0; i < count; i++) {
+        auto start = std::chrono::steady_clock::now();
+        auto fn = [&](std::stop_token stp){return r.call(stp);};
+        int v = delay?co_await cocls::hedge(fn, *delay, 2, sch):co_await cocls::hedge(fn, 1h, 1, sch);
+        if (v != 42) std::cout << "Unexpected result" << std::endl;
+        lat.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::sort(lat.begin(), lat.end());
+    std::cout << (delay?"Hedged:     ":"Not hedged: ")
+              << "p50 " << lat[count / 2] << " ms, p99.5 " << lat[count * 995 / 1000]
+              << " ms, max " << lat.back() << " ms, calls " << r.calls()
+              << ", stopped " << r.wasted() << std::endl;
+}
+
+int main(int, char **) {
+    constexpr int count = 1000;
+    cocls::thread_pool pool(2);
+    cocls::scheduler sch(pool);
+    replica r1(sch);
+    run(sch, r1, nullptr, count).join();
+    replica r2(sch);
+    cocls::hedge_delay delay(0.95, 100, 5ms);
+    run(sch, r2, &delay, count).join();
+    std::cout << "Hedge delay: "
+              << std::chrono::duration<double, std::milli>(delay.get()).count() << " ms" << std::endl;
+}
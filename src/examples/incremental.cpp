@@ -0,0 +1,57 @@
+#include <iostream>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <coclasses/incremental.h>
+
+int main(int, char **) {
+    constexpr int items = 8;
+    cocls::thread_pool pool(4);
+    cocls::incremental_graph g(pool);
+
+    std::vector<std::unique_ptr<cocls::incremental_input<int> > > base;
+    std::vector<std::unique_ptr<cocls::incremental_node<double> > > prices;
+    cocls::incremental_input<double> vat(g, 0.21);
+    cocls::incremental_input<int> discount(g, 0);
+
+    for (int i = 0; i < items; i++) {
+        auto &b = *base.emplace_back(std::make_unique<cocls::incremental_input<int> >(g, 100 + i));
+        prices.push_back(std::make_unique<cocls::incremental_node<double> >(g,
+            [&](cocls::incremental_context &ctx) {
+                //expensive computation
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                return ctx.get(b) * (1.0 + ctx.get(vat));
+        }));
+    }
+    //node implemented as coroutine, awaits other nodes
+    cocls::incremental_node<double> total(g, [&](cocls::incremental_context &ctx) -> cocls::async<double> {
+        double sum = 0;
+        for (auto &p: prices) sum += co_await ctx.get(*p);
+        co_return sum * (100 - ctx.get(discount)) / 100.0;
+    });
+
+    auto step = [&](const char *desc) {
+        auto before = g.computations();
+        auto start = std::chrono::steady_clock::now();
+        double v = total.get().join();
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+        std::cout << desc << ": total=" << v << ", computations=" << (g.computations() - before)
+                  << ", time=" << ms << " ms" << std::endl;
+    };
+
+    step("Initial");
+    step("No change");
+    base[3]->set(200);
+    step("One price changed");
+    discount.set(10);
+    step("Discount changed");
+    discount.set(10);
+    step("Same discount");
+    vat.set(0.15);
+    step("VAT changed (parallel update)");
+    base[5]->set(105);
+    base[5]->set(100 + 5);
+    step("Price changed and restored");
+    return 0;
+}
@@ -0,0 +1,50 @@
+#include <iostream>
+#include <atomic>
+#include <coclasses/task.h>
+#include <coclasses/object_pool.h>
+#include <coclasses/thread_pool.h>
+
+static std::atomic<int> created = 0;
+static std::atomic<int> in_use = 0;
+static std::atomic<int> max_in_use = 0;
+
+struct connection {
+    int id;
+    int requests = 0;
+    connection():id(++created) {}
+};
+
+cocls::task<> worker(cocls::thread_pool &pool, cocls::object_pool<connection> &conns, int count) {
+    co_await pool;
+    for (int i = 0; i < count; i++) {
+        auto conn = co_await conns.acquire();
+        int u = ++in_use;
+        int m = max_in_use;
+        while (u > m && !max_in_use.compare_exchange_weak(m, u));
+        conn->requests++;
+        co_await cocls::pause<>();
+        --in_use;
+    }
+}
+
+int main(int, char **) {
+    cocls::thread_pool pool(4);
+    cocls::object_pool<connection> conns(3);
+    std::vector<cocls::task<> > tasks;
+    for (int i = 0; i < 20; i++) tasks.push_back(worker(pool, conns, 1000));
+    for (auto &t: tasks) t.join();
+    std::cout << "Created connections: " << created << " (max 3)" << std::endl;
+    std::cout << "Max concurrently leased: " << max_in_use << " (max 3)" << std::endl;
+    int total = 0;
+    {
+        std::vector<cocls::object_pool<connection>::lease> all;
+        while (auto l = conns.try_acquire()) {
+            total += (*l)->requests;
+            all.push_back(std::move(*l));
+        }
+    }
+    std::cout << "Requests: " << total << " (expected 20000)" << std::endl;
+    std::cout << "Evicted: " << conns.evict_idle(std::chrono::seconds(0)) << std::endl;
+    auto l = conns.try_acquire();
+    std::cout << "New connection id: " << (*l)->id << " (expected 4)" << std::endl;
+}
@@ -0,0 +1,51 @@
+#include <iostream>
+#include <atomic>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <coclasses/pipeline.h>
+
+//source - produces numbers
+cocls::generator<int> numbers(int count) {
+    for (int i = 0; i < count; i++) co_yield i;
+}
+
+int main(int, char **) {
+    constexpr int count = 2000;
+    cocls::thread_pool pool(4);
+    cocls::pipeline pl(pool);
+
+    std::atomic<long> sum = 0;
+    std::atomic<int> out_of_order = 0;
+    int last = -1;
+
+    pl.source("numbers", []{return numbers(count);})
+      .transform("square", [](int x) {
+            //expensive stage
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            return static_cast<long>(x) * x;
+        }, {.parallelism = 4, .ordered = true, .capacity = 32})
+      .transform("check", [&](long v) {
+            int x = static_cast<int>(std::lround(std::sqrt(static_cast<double>(v))));
+            if (x != last + 1) ++out_of_order;
+            last = x;
+            return v;
+        })
+      .sink("sum", [&](long v) {
+            sum += v;
+        }, {.capacity = 32});
+
+    std::thread monitor([&]{
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        for (const auto &st: pl.stats()) {
+            std::cout << "  " << st.name << ": processed " << st.processed << ", busy " << st.busy
+                      << "/" << st.parallelism << ", queue " << st.queued << "/" << st.capacity << std::endl;
+        }
+    });
+    pl.run().wait();
+    monitor.join();
+
+    long expected = 0;
+    for (long i = 0; i < count; i++) expected += i * i;
+    std::cout << "Sum: " << sum << " (expected " << expected << "), out of order: " << out_of_order << std::endl;
+}
@@ -0,0 +1,101 @@
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+#include <coclasses/priority_channel.h>
+#include <coclasses/task.h>
+#include <coclasses/thread_pool.h>
+
+struct job {
+    int id;
+    int prio;
+};
+
+//strict order with one shard
+void strict_order() {
+    cocls::priority_channel<job> ch;
+    std::mt19937 rnd(1);
+    for (int i = 0; i < 1000; i++) {
+        int p = static_cast<int>(rnd() % 100);
+        ch.push(job{i, p}, p);
+    }
+    int last = 1000;
+    int errors = 0;
+    while (!ch.empty()) {
+        job j = ch.pop().wait();
+        if (j.prio > last) ++errors;
+        last = j.prio;
+    }
+    std::cout << "Strict order errors: " << errors << std::endl;
+}
+
+cocls::task<> consumer(cocls::thread_pool &pool, cocls::priority_channel<job, int> &ch, std::atomic<int> &received, int count) {
+    co_await pool;
+    for (int i = 0; i < count; i++) {
+        job j = co_await ch.pop();
+        if (j.id >= 0) ++received;
+    }
+}
+
+//consumers are waiting, producers pass items directly
+void direct_handoff() {
+    cocls::thread_pool pool(4);
+    cocls::priority_channel<job> ch(4);
+    std::atomic<int> received = 0;
+    std::vector<cocls::task<> > consumers;
+    for (int i = 0; i < 4; i++) {
+        consumers.push_back(consumer(pool, ch, received, 2500));
+    }
+    std::vector<std::thread> producers;
+    for (int i = 0; i < 4; i++) {
+        producers.emplace_back([&, i]{
+            for (int j = 0; j < 2500; j++) ch.push(job{i * 2500 + j, j % 10}, j % 10);
+        });
+    }
+    for (auto &t: producers) t.join();
+    for (auto &t: consumers) t.join();
+    std::cout << "Received: " << received << ", left: " << ch.size() << std::endl;
+}
+
+//old item with low priority is served before new item with higher priority
+void aging() {
+    cocls::priority_channel<job> plain;
+    cocls::priority_channel<job> aged(1, std::chrono::milliseconds(1));
+    plain.push(job{1, 0}, 0);
+    aged.push(job{1, 0}, 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    plain.push(job{2, 10}, 10);
+    aged.push(job{2, 10}, 10);
+    std::cout << "Without aging first: " << plain.pop().wait().id
+              << ", with aging first: " << aged.pop().wait().id << std::endl;
+}
+
+cocls::task<> producer(cocls::limited_priority_channel<job> &ch, int &blocked) {
+    for (int i = 0; i < 10; i++) {
+        auto f = ch.push(job{i, i}, i);
+        if (!f.ready()) ++blocked;
+        co_await f;
+    }
+}
+
+//bounded channel suspends producer
+void limited() {
+    cocls::limited_priority_channel<job> ch(4);
+    int blocked = 0;
+    auto t = producer(ch, blocked);
+    std::cout << "Items: " << ch.size() << ", producer blocked: " << blocked << std::endl;
+    std::cout << "Popped:";
+    for (int i = 0; i < 10; i++) std::cout << " " << ch.pop().wait().id;
+    std::cout << std::endl;
+    t.join();
+}
+
+int main(int, char **) {
+    strict_order();
+    direct_handoff();
+    aging();
+    limited();
+    return 0;
+}
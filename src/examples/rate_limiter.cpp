@@ -0,0 +1,29 @@
+#include <iostream>
+#include <chrono>
+#include <coclasses/task.h>
+#include <coclasses/rate_limiter.h>
+#include <coclasses/thread_pool.h>
+
+cocls::task<> call(cocls::rate_limiter &limiter) {
+    co_await limiter.acquire();
+}
+
+int main(int, char **) {
+    constexpr int calls = 1000;
+    constexpr double rate = 2000;
+    constexpr unsigned int burst = 100;
+
+    cocls::thread_pool pool(2);
+    cocls::scheduler sch(pool);
+    cocls::rate_limiter limiter(sch, rate, burst);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<cocls::task<> > tasks;
+    for (int i = 0; i < calls; i++) tasks.push_back(call(limiter));
+    std::cout << "Waiting callers: " << limiter.waiting() << " (one timer)" << std::endl;
+    for (auto &t: tasks) t.join();
+    auto dur = std::chrono::steady_clock::now() - start;
+    std::cout << calls << " calls took "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(dur).count()
+              << " ms (expected about " << static_cast<int>((calls - burst) * 1000 / rate) << " ms)" << std::endl;
+}
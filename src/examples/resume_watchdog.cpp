@@ -0,0 +1,21 @@
+#include <iostream>
+#include <coclasses/task.h>
+#include <coclasses/thread_pool.h>
+#include <coclasses/resume_watchdog.h>
+
+
+
+cocls::task<> co_slow(cocls::thread_pool &pool) {
+    co_await pool;
+    std::cout << "slow coroutine is blocking the worker" << std::endl;
+    //this blocks the worker - watchdog reports this
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    std::cout << "slow coroutine finished" << std::endl;
+}
+
+
+int main(int, char **) {
+    cocls::resume_watchdog wd(std::chrono::milliseconds(50));
+    cocls::thread_pool pool(2, wd);
+    co_slow(pool).join();
+}
@@ -0,0 +1,99 @@
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <coclasses/shared_snapshot.h>
+#include <coclasses/thread_pool.h>
+#include <coclasses/task.h>
+
+std::atomic<int> live = 0;
+
+struct config {
+    int version;
+    int routes[16];
+    config(int v):version(v) {
+        ++live;
+        for (auto &x: routes) x = v;
+    }
+    config(const config &other):version(other.version) {
+        ++live;
+        for (int i = 0; i < 16; i++) routes[i] = other.routes[i];
+    }
+    ~config() {
+        //poison, so use after free is detected
+        version = -1;
+        --live;
+    }
+};
+
+std::atomic<int> errors = 0;
+
+//readers serve batches of requests in the thread pool, writer publishes every 1 ms
+//returns reads per millisecond
+template<typename Read, typename Write>
+long bench(Read &&read, Write &&write) {
+    constexpr int readers = 4;
+    cocls::thread_pool pool(readers);
+    std::atomic<bool> stop = false;
+    std::atomic<long> reads = 0;
+    std::function<void()> serve = [&]{
+        for (int j = 0; j < 10000; j++) {
+            if (!read()) ++errors;
+        }
+        reads += 10000;
+        if (!stop.load(std::memory_order_relaxed)) pool.run_detached([&]{serve();});
+    };
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < readers; i++) pool.run_detached([&]{serve();});
+    for (int i = 1; i <= 200; i++) {
+        write(i);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    stop = true;
+    pool.stop();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    return reads / std::max<long>(ms, 1);
+}
+
+cocls::task<> wait_readers(cocls::shared_snapshot<config> &cfg) {
+    cfg.update([](config &c){c.routes[0] = 0;});
+    //wait for readers of old snapshots without blocking thread
+    co_await cfg.synchronize();
+    std::cout << "Old readers finished" << std::endl;
+}
+
+int main(int, char **) {
+    cocls::shared_snapshot<config> cfg(0);
+    long r1 = bench([&]{
+        auto r = cfg.read();
+        return r->version >= 0 && r->routes[7] == r->version;
+    }, [&](int v) {
+        cfg.publish(config(v));
+    });
+
+    std::mutex mx;
+    auto shared = std::make_shared<config>(0);
+    long r2 = bench([&]{
+        std::shared_ptr<config> r;
+        {
+            std::lock_guard _(mx);
+            r = shared;
+        }
+        return r->version >= 0 && r->routes[7] == r->version;
+    }, [&](int v) {
+        auto n = std::make_shared<config>(v);
+        std::lock_guard _(mx);
+        shared = n;
+    });
+    shared.reset();
+
+    wait_readers(cfg).join();
+
+    std::cout << "Snapshot reads/ms: " << r1 << ", mutex+shared_ptr reads/ms: " << r2 << std::endl;
+    std::cout << "Errors: " << errors << ", live snapshots: " << live << std::endl;
+    return 0;
+}
@@ -0,0 +1,74 @@
+#include <iostream>
+#include <chrono>
+#include <coclasses/task.h>
+#include <coclasses/shm_channel.h>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using channel = cocls::shm_channel<long>;
+
+//child process - returns every request incremented by one, then sums the stream
+cocls::task<> echo(channel &in, channel &out) {
+    for(;;) {
+        long v = co_await in.pop();
+        if (v < 0) break;
+        co_await out.push(v + 1);
+    }
+    long sum = 0;
+    try {
+        for(;;) {
+            sum += co_await in.pop();
+        }
+    } catch (const cocls::await_canceled_exception &) {
+        //channel closed
+    }
+    co_await out.push(sum);
+}
+
+cocls::task<> ping(channel &out, channel &in, int count) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++) {
+        co_await out.push(i);
+        long r = co_await in.pop();
+        if (r != i + 1) std::cout << "Unexpected reply " << r << std::endl;
+    }
+    auto dur = std::chrono::steady_clock::now() - start;
+    std::cout << "Round trip: "
+              << std::chrono::duration_cast<std::chrono::nanoseconds>(dur).count() / count
+              << " ns" << std::endl;
+}
+
+cocls::task<> stream(channel &out, int count) {
+    co_await out.push(-1);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++) {
+        co_await out.push(i);
+    }
+    out.close();
+    auto dur = std::chrono::steady_clock::now() - start;
+    std::cout << "Streamed " << count << " items in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(dur).count() << " ms" << std::endl;
+}
+
+int main(int, char **) {
+    constexpr int rounds = 10000;
+    constexpr int items = 1000000;
+    auto to_child = channel::create_anonymous(1024);
+    auto to_parent = channel::create_anonymous(1024);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        auto in = channel::attach(to_child.fd());
+        auto out = channel::attach(to_parent.fd());
+        echo(in, out).join();
+        std::cout.flush();
+        _exit(0);
+    }
+
+    ping(to_child, to_parent, rounds).join();
+    stream(to_child, items).join();
+    long sum = to_parent.pop().wait();
+    std::cout << "Sum: " << sum << " (expected " << static_cast<long>(items) * (items - 1) / 2 << ")" << std::endl;
+    waitpid(pid, nullptr, 0);
+}
@@ -0,0 +1,43 @@
+#include <iostream>
+#include <coclasses/task.h>
+#include <coclasses/strand.h>
+
+//counter is protected by the strand, no mutex is needed
+static int counter = 0;
+
+cocls::task<> co_increment(cocls::strand str, int count) {
+    co_await str;
+    for (int i = 0; i < count; i++) {
+        ++counter;
+        //leave the strand and enter again
+        co_await str;
+    }
+}
+
+cocls::task<void, cocls::resumption_policy::strand> co_policy(int count) {
+    //this coroutine always runs in the strand
+    for (int i = 0; i < count; i++) {
+        ++counter;
+        co_await cocls::pause<>();
+    }
+    co_return;
+}
+
+
+int main(int, char **) {
+    cocls::thread_pool pool(4);
+    cocls::strand str(pool);
+    std::vector<cocls::task<> > tasks;
+    for (int i = 0; i < 4; i++) {
+        tasks.push_back(co_increment(str, 10000));
+    }
+    auto t = co_policy(10000);
+    t.initialize_policy(str);
+    for (int i = 0; i < 10000; i++) {
+        str.run_detached([]{++counter;});
+    }
+    for (auto &x: tasks) x.join();
+    t.join();
+    int r = str.run([]{return counter;}).wait();
+    std::cout << "Counter: " << r << " (expected 60000)" << std::endl;
+}
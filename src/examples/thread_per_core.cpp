@@ -0,0 +1,83 @@
+#include <iostream>
+#include <chrono>
+#include <coclasses/task.h>
+#include <coclasses/thread_per_core.h>
+
+#include <unistd.h>
+
+//every core has own counter, it is touched only by the core's thread
+struct alignas(cocls::thread_per_core::cache_line) core_counter {
+    long count = 0;
+};
+
+cocls::task<> hopper(cocls::thread_per_core &rt, std::vector<core_counter> &counters, int hops) {
+    co_await rt.on_core(0);
+    for (int i = 0; i < hops; i++) {
+        co_await cocls::on_core(i % rt.size());
+        ++counters[cocls::thread_per_core::current_core()].count;
+    }
+}
+
+cocls::task<> writer(cocls::thread_per_core &rt, int fd) {
+    co_await rt.on_core(rt.size() - 1);
+    co_await cocls::thread_per_core::sleep_for(std::chrono::milliseconds(50));
+    [[maybe_unused]] auto r = ::write(fd, "x", 1);
+}
+
+cocls::task<> reader(cocls::thread_per_core &rt) {
+    co_await rt.on_core(0);
+    int fds[2];
+    if (::pipe(fds)) co_return;
+    auto w = writer(rt, fds[1]);
+    auto start = std::chrono::steady_clock::now();
+    std::uint32_t ev = co_await cocls::thread_per_core::wait_io(fds[0], EPOLLIN);
+    auto dur = std::chrono::steady_clock::now() - start;
+    char c;
+    [[maybe_unused]] auto r = ::read(fds[0], &c, 1);
+    std::cout << "Reader on core " << cocls::thread_per_core::current_core()
+              << " received '" << c << "' events=" << ev << " after "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(dur).count() << " ms" << std::endl;
+    co_await w;
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+cocls::task<int, cocls::resumption_policy::thread_per_core> pinned(int count) {
+    //this coroutine always runs on its home core
+    int wrong = 0;
+    unsigned int home = cocls::thread_per_core::current_core();
+    for (int i = 0; i < count; i++) {
+        co_await cocls::on_core(i % cocls::thread_per_core::current()->size());
+        co_await cocls::pause<>();
+        if (cocls::thread_per_core::current_core() != home) ++wrong;
+    }
+    co_return wrong;
+}
+
+
+int main(int, char **) {
+    constexpr int coros = 100;
+    constexpr int hops = 10000;
+    cocls::thread_per_core rt(4);
+    std::vector<core_counter> counters(rt.size());
+
+    reader(rt).join();
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<cocls::task<> > tasks;
+    for (int i = 0; i < coros; i++) tasks.push_back(hopper(rt, counters, hops));
+    for (auto &t: tasks) t.join();
+    auto dur = std::chrono::steady_clock::now() - start;
+
+    long total = 0;
+    for (unsigned int i = 0; i < rt.size(); i++) {
+        std::cout << "Core " << i << ": " << counters[i].count << std::endl;
+        total += counters[i].count;
+    }
+    std::cout << "Total hops: " << total << " (expected " << coros * hops << ") in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(dur).count() << " ms" << std::endl;
+
+    auto p = pinned(1000);
+    p.initialize_policy(rt, 2);
+    std::cout << "Pinned coroutine resumed outside of home core: " << p.join() << " times (expected 0)" << std::endl;
+}
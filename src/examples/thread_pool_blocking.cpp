@@ -0,0 +1,27 @@
+#include <iostream>
+#include <coclasses/thread_pool.h>
+
+#include <atomic>
+
+
+int main(int, char **) {
+    cocls::thread_pool pool(2);
+    std::atomic<int> done = 0;
+    auto start = std::chrono::steady_clock::now();
+    //blocking jobs - each job blocks its worker, but the pool
+    //activates compensating worker, so other jobs are processed meanwhile
+    for (int i = 0; i < 4; i++) {
+        pool.run_detached([&]{
+            cocls::thread_pool::blocking_section _;
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            ++done;
+        });
+    }
+    //short jobs
+    int r = pool.run([]{return 42;}).wait();
+    auto dur = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    std::cout << "short job: " << r << " after " << dur.count() << " ms" << std::endl;
+    while (done != 4) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    dur = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    std::cout << "blocking jobs finished after " << dur.count() << " ms" << std::endl;
+}
@@ -0,0 +1,22 @@
+#include <iostream>
+#include <coclasses/task.h>
+#include <coclasses/thread_pool.h>
+
+
+//Single thread pool. The function waits synchronously for a work, which is enqueued
+//into the same pool. The worker processes the enqueued work while it is waiting
+int main(int, char **) {
+    cocls::thread_pool pool(1);
+    int r = pool.run([&]{
+        std::cout << "outer thread " << std::this_thread::get_id() << std::endl;
+        int a = pool.run([]{
+            std::cout << "inner thread " << std::this_thread::get_id() << std::endl;
+            return 20;
+        }).wait();
+        int b = pool.run([]{
+            return 22;
+        }).wait();
+        return a + b;
+    }).wait();
+    std::cout << r << std::endl;
+}
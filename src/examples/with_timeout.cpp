@@ -0,0 +1,59 @@
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <coclasses/task.h>
+#include <coclasses/with_timeout.h>
+#include <coclasses/thread_pool.h>
+
+using namespace std::chrono_literals;
+
+//resolves the promise after given delay in a separate thread
+cocls::future<int> delayed_value(int v, std::chrono::milliseconds delay) {
+    return [&](auto promise) {
+        std::thread([v, delay, promise = std::move(promise)]() mutable {
+            std::this_thread::sleep_for(delay);
+            promise(v);
+        }).detach();
+    };
+}
+
+cocls::task<> fast_operation(cocls::scheduler &sch) {
+    cocls::future<int> f = delayed_value(42, 20ms);
+    std::optional<int> r = co_await cocls::with_timeout(f, 500ms, sch);
+    if (r) std::cout << "Fast operation: " << *r << std::endl;
+    else std::cout << "Fast operation: timeout (unexpected)" << std::endl;
+}
+
+cocls::task<> slow_operation(cocls::scheduler &sch) {
+    cocls::future<int> f = delayed_value(56, 200ms);
+    auto start = std::chrono::steady_clock::now();
+    std::optional<int> r = co_await cocls::with_timeout(f, 50ms, sch);
+    auto dur = std::chrono::steady_clock::now() - start;
+    std::cout << "Slow operation: " << (r?"value":"timeout") << " after "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(dur).count() << " ms" << std::endl;
+    //awaiter has been unsubscribed, the future can be awaited again
+    int v = co_await f;
+    std::cout << "Slow operation finally: " << v << std::endl;
+}
+
+//operation and timer race each other
+cocls::task<> race(cocls::scheduler &sch, int count) {
+    int values = 0, timeouts = 0;
+    for (int i = 0; i < count; i++) {
+        cocls::future<void> f = sch.sleep_for(std::chrono::microseconds(100));
+        if (co_await cocls::with_timeout(f, std::chrono::microseconds(90 + i % 20), sch)) ++values;
+        else {
+            ++timeouts;
+            co_await f;
+        }
+    }
+    std::cout << "Race: " << values << " values, " << timeouts << " timeouts" << std::endl;
+}
+
+int main(int, char **) {
+    cocls::thread_pool pool(2);
+    cocls::scheduler sch(pool);
+    fast_operation(sch).join();
+    slow_operation(sch).join();
+    race(sch, 2000).join();
+}